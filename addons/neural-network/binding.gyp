@@ -1,4 +1,17 @@
 {
+  "variables": {
+    # Instruction set for the int8 kernels: none, avx2 or vnni.
+    "simd%": "none",
+    "conditions": [
+      # Look for a CBLAS library with pkg-config. Override with
+      # `node-gyp rebuild -- -Dblas=none` (or openblas, blis, mkl).
+      ["OS!='win'", {
+        "blas%": "<!(sh -c 'for p in openblas blis mkl-dynamic-lp64-seq; do pkg-config --exists $p 2>/dev/null && echo $p && exit; done; echo none')"
+      }, {
+        "blas%": "none"
+      }]
+    ]
+  },
   "targets": [
     {
       "target_name": "neural-network",
@@ -6,11 +19,65 @@
         "include"
       ],
       "sources": [
+        "src/blas.cc",
+        "src/checkpoint.cc",
         "src/data-class.cc",
+        "src/ensemble.cc",
+        "src/epoch-log.cc",
+        "src/importance-sampler.cc",
+        "src/inference-server.cc",
+        "src/layer.cc",
+        "src/model-file.cc",
+        "src/model-registry.cc",
+        "src/model.cc",
         "src/neural-network.cc",
         "src/node.cc",
+        "src/prediction-cache.cc",
+        "src/quantized-layer.cc",
         "src/random.cc",
-        "src/tools.cc"
+        "src/result-cache.cc",
+        "src/shared-model.cc",
+        "src/shared-network.cc",
+        "src/snapshot-writer.cc",
+        "src/table-reader.cc",
+        "src/text-writer.cc",
+        "src/thread-pool.cc",
+        "src/tools.cc",
+        "src/training-metrics.cc"
+      ],
+      "conditions": [
+        ["OS!='win'", {
+          "libraries": [
+            "-ldl"
+          ]
+        }],
+        ["OS=='linux'", {
+          "libraries": [
+            "-lrt"
+          ]
+        }],
+        ["simd=='avx2'", {
+          "cflags": [ "-mavx2" ],
+          "xcode_settings": { "OTHER_CFLAGS": [ "-mavx2" ] },
+          "msvs_settings": { "VCCLCompilerTool": { "AdditionalOptions": [ "/arch:AVX2" ] } }
+        }],
+        ["simd=='vnni'", {
+          "cflags": [ "-mavx2", "-mavxvnni" ],
+          "xcode_settings": { "OTHER_CFLAGS": [ "-mavx2", "-mavxvnni" ] },
+          "msvs_settings": { "VCCLCompilerTool": { "AdditionalOptions": [ "/arch:AVX2", "/D__AVXVNNI__" ] } }
+        }],
+        ["blas!='none'", {
+          "defines": [
+            "ANN_CBLAS",
+            "ANN_CBLAS_NAME=\"<(blas)\""
+          ],
+          "cflags": [
+            "<!@(pkg-config --cflags <(blas))"
+          ],
+          "libraries": [
+            "<!@(pkg-config --libs <(blas))"
+          ]
+        }]
       ]
     }
   ]
@@ -0,0 +1,73 @@
+#ifndef BLAS_HH
+#define BLAS_HH
+
+#include <string>
+
+namespace blas
+{
+  // Entry points of a CBLAS library loaded at runtime.
+  struct Library;
+
+  // Row-major, double precision linear algebra kernels. The built-in
+  // kernels are used unless a CBLAS library (OpenBLAS, BLIS, MKL) was
+  // linked in at build time or loaded at runtime.
+  //
+  // A backend never changes once in use: loading a library publishes a
+  // new one, and each kernel is handed the backend it was looked up
+  // from, so a call already under way finishes on the backend it
+  // started with.
+  struct Backend
+  {
+    // Name reported to JavaScript.
+    std::string name;
+    // C = alpha * op(A) * op(B) + beta * C, where op(A) is m x k and
+    // op(B) is k x n.
+    void (*gemm)(const Backend& self, bool transA, bool transB, int m, int n, int k, double alpha,
+      const double* a, int lda, const double* b, int ldb, double beta, double* c, int ldc);
+    // y = alpha * op(A) * x + beta * y, where A is m x n.
+    void (*gemv)(const Backend& self, bool trans, int m, int n, double alpha, const double* a, int lda,
+      const double* x, double beta, double* y);
+    // y = alpha * x + y.
+    void (*axpy)(const Backend& self, int n, double alpha, const double* x, double* y);
+    // Returns the dot product of x and y.
+    double (*dot)(const Backend& self, int n, const double* x, const double* y);
+    // The library a loaded backend calls into (NULL for the others).
+    const Library* library;
+  };
+
+  // Returns the backend currently in use. Safe to call from any thread.
+  const Backend& active();
+  // Loads a CBLAS shared library (e.g. libopenblas.so) and uses it from
+  // then on. Returns false, leaving the backend unchanged, if the
+  // library or any of its symbols cannot be found. The library and its
+  // backend stay in memory for the lifetime of the process.
+  bool load(const std::string& path);
+  // Reverts to the backend chosen at build time.
+  void reset();
+
+  // Shorthands for the active backend.
+  inline void gemm(bool transA, bool transB, int m, int n, int k, double alpha,
+    const double* a, int lda, const double* b, int ldb, double beta, double* c, int ldc)
+  {
+    const Backend& backend = active();
+    backend.gemm(backend, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+  inline void gemv(bool trans, int m, int n, double alpha, const double* a, int lda,
+    const double* x, double beta, double* y)
+  {
+    const Backend& backend = active();
+    backend.gemv(backend, trans, m, n, alpha, a, lda, x, beta, y);
+  }
+  inline void axpy(int n, double alpha, const double* x, double* y)
+  {
+    const Backend& backend = active();
+    backend.axpy(backend, n, alpha, x, y);
+  }
+  inline double dot(int n, const double* x, const double* y)
+  {
+    const Backend& backend = active();
+    return backend.dot(backend, n, x, y);
+  }
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CHECKPOINT_HH
+#define CHECKPOINT_HH
+
+#include <string>
+#include <vector>
+
+namespace ANN
+{
+  // Everything a training run needs to carry on exactly where it stopped:
+  // the weights and the momentum terms, the epoch reached, the accuracy
+  // history, the row order, the random generator and the importance
+  // sampler's losses.
+  //
+  // Stored as a binary file (little-endian): the magic "ANNCHKPT", a
+  // uint32 format version, the fields below in order (vectors prefixed
+  // by their uint64 length) and a uint64 checksum of all that precedes
+  // it.
+  struct Checkpoint
+  {
+    static const unsigned VERSION = 1;
+
+    // Number of nodes in each layer, input layer first.
+    std::vector<int> topology;
+    // Per layer, Layer::params and Layer::prevDelta.
+    std::vector<std::vector<double>> params;
+    std::vector<std::vector<double>> prevDelta;
+    double momentum = 0.0;
+    double weightDecay = 0.0;
+    // Epochs completed, and their accuracies.
+    int epoch = 0;
+    std::vector<double> trainingAccuracy;
+    std::vector<double> testingAccuracy;
+    // Order of the training rows after the last shuffle.
+    std::vector<int> order;
+    // Random::state() of the shared generator.
+    std::string random;
+    // Per-row loss estimates; empty without a sampler.
+    std::vector<double> losses;
+
+    // Returns the checkpoint in the file format.
+    std::string bytes() const;
+    // Reads a checkpoint from bytes in the file format, naming it path in
+    // any error. Returns false and sets error if it is damaged or of
+    // another version.
+    bool parse(const std::string& bytes, const std::string& path, std::string& error);
+    // Writes the checkpoint to path, replacing it in one step. Returns
+    // false and sets error on failure.
+    bool write(const std::string& path, std::string& error) const;
+    // Reads a checkpoint written by write(). Returns false and sets error
+    // if the file is missing, damaged or of another version.
+    bool read(const std::string& path, std::string& error);
+  };
+}
+
+#endif
@@ -21,6 +21,8 @@ namespace ANN
 
   class DataClass : public node::ObjectWrap
   {
+    // Seeds random through NeuralNetwork.seed().
+    friend class NeuralNetwork;
   public:
     // Used for initiating DataClass in NodeJS.
     static void Init(Local<Object> exports);
@@ -79,9 +81,12 @@ namespace ANN
     static void GetExemplar(const FunctionCallbackInfo<Value>& args);
     // Alters the inner data of the DataClass to an exemplar set.
     static void MakeExemplar(const FunctionCallbackInfo<Value>& args);
-    // Reads data in from a file.
+    // Reads data in from a file. Throws, naming the line and column, if
+    // a value is not a number or a row has the wrong number of values.
     static void ReadFromFile(const FunctionCallbackInfo<Value>& args);
-    // Writes data (matrix) out to a file (truncating if necessary).
+    // Writes data (matrix) out to a file (truncating if necessary). An
+    // optional second argument sets the decimal places (default 2), or
+    // 'shortest' writes each value exactly in as few digits as possible.
     static void WriteToFile(const FunctionCallbackInfo<Value>& args);
 
     // Generates a sequence of random indices of length count.
@@ -92,7 +97,11 @@ namespace ANN
     // Generates a JavaScript correspondent array from a vector of sets.
     static Local<Array> CreateArrayFromSets(Isolate* isolate, std::vector<DataClass*>& sets);
 
-    void _ReadFromFile(const std::string& path, Isolate* isolate = NULL);
+    // Replaces the data with the table in the file at path (see
+    // TableReader). On failure, throws the error into JavaScript through
+    // isolate (or as a std::string without one), leaves the data as it
+    // was and returns false.
+    bool _ReadFromFile(const std::string& path, Isolate* isolate = NULL);
 
     bool set_row(int index, std::vector<double>& row);
     void resize_rows(int rows);
@@ -0,0 +1,67 @@
+#ifndef ENSEMBLE_HH
+#define ENSEMBLE_HH
+
+#include "neural-network.hh"
+#include "random.hh"
+#include "thread-pool.hh"
+#include <memory>
+#include <node.h>
+#include <node_object_wrap.h>
+#include <vector>
+
+namespace ANN
+{
+  using v8::Function;
+  using v8::FunctionCallbackInfo;
+  using v8::Local;
+  using v8::Object;
+  using v8::Persistent;
+  using v8::Value;
+
+  // A bag of networks sharing one topology, each trained on its own
+  // bootstrap resample of the same data.
+  class Ensemble : public node::ObjectWrap
+  {
+  public:
+    static void Init(Local<Object> exports);
+  private:
+    static Persistent<Function> constructor;
+    static void New(const FunctionCallbackInfo<Value>& args);
+
+    // Number of nodes in each layer, input layer first.
+    std::vector<int> topology;
+    std::vector<std::unique_ptr<NeuralNetwork>> members;
+    // Trains members and splits predictions between threads. NULL when
+    // running single-threaded.
+    std::unique_ptr<ThreadPool> pool;
+
+    // The first layer of every member side by side, so one product
+    // covers all of them: numInput rows of members * topology[1] weights,
+    // and the matching biases.
+    std::vector<double> stackedWeights;
+    std::vector<double> stackedBiases;
+
+    explicit Ensemble(int count, const std::vector<int>& topology);
+
+    // :: PUBLICLY AVAILABLE FUNCTIONS :: //
+    // Trains every member on a bootstrap resample of a DataClass.
+    // Arguments: data, epochs, learning rate.
+    static void Train(const FunctionCallbackInfo<Value>& args);
+    // Returns the combined class probabilities of each row as a
+    // Float64Array. Takes the same rows as NeuralNetwork.predict() and
+    // optionally 'vote' to return the share of members voting for each
+    // class instead of their average probabilities.
+    static void Predict(const FunctionCallbackInfo<Value>& args);
+    // Returns the number of members.
+    static void Size(const FunctionCallbackInfo<Value>& args);
+
+    // :: PRIVATE FUNCTIONS :: //
+    // Copies the members' first layers into stackedWeights/Biases.
+    void Stack();
+    // Trains member m for epochs over rows drawn with replacement.
+    void TrainMember(int m, Matrix<double>& data, int epochs, double learnRate, Random& random);
+    void PredictBatch(const NeuralNetwork::PredictInput& input, double* probs, bool vote);
+  };
+}
+
+#endif
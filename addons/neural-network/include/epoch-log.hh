@@ -0,0 +1,117 @@
+#ifndef EPOCH_LOG_HH
+#define EPOCH_LOG_HH
+
+#include "text-writer.hh"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ANN
+{
+  // Layout of the lines of an EpochLog.
+  enum class LogFormat
+  {
+    // "epoch trainMSE testMSE trainAccuracy% testAccuracy% [visited]",
+    // the format train() has always written. Ignores the columns.
+    Text,
+    // A header naming the columns, then one comma separated line per
+    // epoch.
+    Csv,
+    // The magic "ANNEPLOG", a uint32 version, a uint32 column count and
+    // a uint32 LogColumn per column, then per epoch a float64 per column
+    // (all little-endian).
+    Binary
+  };
+
+  enum class LogColumn
+  {
+    // Epochs completed.
+    Epoch,
+    TrainMSE,
+    TestMSE,
+    // Accuracies in percent.
+    TrainAccuracy,
+    TestAccuracy,
+    // Distinct rows the importance sampler visited (-1 without one).
+    Visited,
+    // Wall time of the epoch.
+    Seconds
+  };
+
+  // What is logged for an epoch.
+  struct EpochRecord
+  {
+    int epoch;
+    double trainMSE;
+    double testMSE;
+    double trainAccuracy;
+    double testAccuracy;
+    int visited;
+    double seconds;
+  };
+
+  // Writes train()'s per-epoch log on a thread of its own.
+  //
+  // push() copies a record into a fixed ring shared with the writer
+  // thread without taking a lock; the writer formats what it finds into
+  // a TextWriter and hands that to the file at most once per flush
+  // interval (and when closed). The ring only fills if the disk cannot
+  // keep up, in which case push() waits for room rather than lose lines.
+  class EpochLog
+  {
+  public:
+    // Records the ring holds.
+    static const int CAPACITY = 1024;
+
+    // Opens the log at path, adding to it when append is set. Columns
+    // are used by the CSV and binary formats; flushMillis is the longest
+    // a line waits to be written.
+    EpochLog(const std::string& path, bool append, LogFormat format, const std::vector<LogColumn>& columns, int flushMillis = 1000);
+    // Writes whatever is still queued, then stops the thread.
+    ~EpochLog();
+
+    // Returns the column called name ("epoch", "trainMSE", "testMSE",
+    // "trainAccuracy", "testAccuracy", "visited" or "seconds") in column.
+    // Returns false for any other name.
+    static bool parseColumn(const std::string& name, LogColumn& column);
+
+    // Queues a record. Called from one thread only.
+    void push(const EpochRecord& record);
+    // Writes everything queued and closes the file. Returns false if the
+    // log could not be written.
+    bool close();
+  private:
+    static const unsigned VERSION = 1;
+
+    LogFormat format;
+    std::vector<LogColumn> columns;
+    int flushMillis;
+    std::unique_ptr<TextWriter> out;
+
+    // Single producer, single consumer ring. head is advanced by push(),
+    // tail by the writer; both only grow.
+    std::vector<EpochRecord> ring;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+    // Only used to sleep and wake the writer.
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool closed = false;
+
+    std::thread thread;
+
+    // Writes the header of a new file.
+    void header();
+    void write(const EpochRecord& record);
+    // Drains the ring until stopped.
+    void run();
+  };
+}
+
+#endif
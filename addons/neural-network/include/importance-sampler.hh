@@ -0,0 +1,41 @@
+#ifndef IMPORTANCE_SAMPLER_HH
+#define IMPORTANCE_SAMPLER_HH
+
+#include "random.hh"
+#include <vector>
+
+// Chooses the training rows for each epoch with probability proportional
+// to a running estimate of each row's loss. Rows are drawn with
+// replacement and each draw carries an importance weight of 1 / (n * p),
+// so the expected gradient matches that of a uniform pass.
+class ImportanceSampler
+{
+public:
+	// rows      the number of training rows
+	// fraction  the number of draws per epoch as a fraction of rows
+	// mix       the share of probability spread uniformly over all rows,
+	//           which bounds the importance weights by 1 / mix
+	ImportanceSampler(int rows = 0, double fraction = 1.0, double mix = 0.1);
+
+	// Returns the number of training rows.
+	int rows();
+	// Draws the rows (and their weights) for the next epoch.
+	void draw(Random& random, std::vector<int>& sequence, std::vector<double>& weights);
+	// Records the loss of a row, as seen during its forward pass.
+	void update(int row, double loss);
+	// Returns the number of distinct rows in the last draw.
+	int visited();
+
+	// Per-row loss estimates.
+	std::vector<double> losses;
+	double fraction;
+	double mix;
+private:
+	// Cumulative probabilities used for drawing.
+	std::vector<double> cumulative;
+	// Marks rows seen in the last draw.
+	std::vector<char> seen;
+	int distinct = 0;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef INFERENCE_SERVER_HH
+#define INFERENCE_SERVER_HH
+
+#include "model.hh"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ANN
+{
+  struct ServerOptions
+  {
+    // Unix domain socket to listen on. When empty, listens on TCP port
+    // on localhost instead (0 picks a free port).
+    std::string socketPath;
+    int port = 0;
+    // Most rows run through the model in one batch.
+    int maxBatch = 64;
+    // Longest a request waits for others to share its batch.
+    int maxWaitMicros = 200;
+    // Number of threads running batches.
+    int workers = 2;
+  };
+
+  struct ServerStats
+  {
+    long long requests = 0;
+    long long rows = 0;
+    long long batches = 0;
+    long long errors = 0;
+    // Rows waiting for a worker.
+    int queueDepth = 0;
+    // Request latencies; bucket b counts those under 2^b microseconds,
+    // the last bucket everything slower.
+    std::vector<long long> latency;
+  };
+
+  // Serves predictions over a local socket, coalescing concurrent
+  // requests into micro-batches. Each batch runs on whichever Model the
+  // handle holds when the batch starts, so the weights can be replaced
+  // while serving.
+  //
+  // Sockets are non-blocking: workers queue their responses on the
+  // connection and the I/O thread sends them as the socket allows. A
+  // client that does not read its responses is no longer read from once
+  // it has too many of them pending or too many rows waiting, so it
+  // cannot hold up the workers or grow the server without limit.
+  //
+  // Every message is a header of 32-bit unsigned integers in host byte
+  // order followed by 32-bit floats:
+  //   request   id, rows, cols, then rows * cols inputs
+  //   response  id, status, rows, cols, then rows * cols probabilities
+  // A status other than OK carries no rows. Responses on a connection may
+  // arrive in a different order from the requests; match them by id.
+  class InferenceServer
+  {
+  public:
+    enum Status
+    {
+      OK = 0,
+      // cols did not match the number of inputs.
+      WRONG_COLUMNS = 1
+    };
+
+    static const int LATENCY_BUCKETS = 24;
+    // Requests larger than this close the connection.
+    static const size_t MAX_REQUEST_BYTES = 64 << 20;
+    // Reading from a connection pauses while it has this many response
+    // bytes unsent or this many rows waiting for a worker, and reading
+    // from every connection while MAX_QUEUED_ROWS rows are waiting.
+    static const size_t MAX_PENDING_BYTES = 16 << 20;
+    static const int MAX_CONNECTION_ROWS = 1 << 16;
+    static const int MAX_QUEUED_ROWS = 1 << 20;
+
+    InferenceServer(std::shared_ptr<ModelHandle> models, const ServerOptions& options);
+    ~InferenceServer();
+
+    // Opens the socket and starts the threads. Returns false with a
+    // message in error on failure.
+    bool start(std::string& error);
+    // Stops the threads and closes every connection.
+    void stop();
+    // Returns the TCP port being listened on (0 for a Unix socket).
+    int port();
+    ServerStats stats();
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection
+    {
+      explicit Connection(int fd);
+      ~Connection();
+      int fd;
+      // Bytes received but not yet parsed (I/O thread only).
+      std::vector<char> buffer;
+      // The peer has stopped sending (I/O thread only).
+      bool finished = false;
+
+      // Guards the rest, which the workers share with the I/O thread.
+      std::mutex mutex;
+      // Responses not yet sent, from output[written] on.
+      std::vector<char> output;
+      size_t written = 0;
+      // Requests and rows waiting for a worker.
+      int requests = 0;
+      int rows = 0;
+      // Set once the I/O thread drops the connection; later responses are
+      // discarded.
+      bool closed = false;
+    };
+
+    struct Request
+    {
+      std::shared_ptr<Connection> connection;
+      unsigned int id;
+      // Requests that fail to parse are still queued, so their replies are
+      // sent by a worker rather than blocking the I/O thread.
+      Status status;
+      int rows;
+      std::vector<double> inputs;
+      Clock::time_point arrived;
+    };
+
+    std::shared_ptr<ModelHandle> models;
+    ServerOptions options;
+    int numInput;
+    int numOutput;
+
+    int listener = -1;
+    // Written to wake the I/O thread when stopping or when there is
+    // output to send.
+    int wakePipe[2] = { -1, -1 };
+    int boundPort = 0;
+    bool running = false;
+
+    std::thread io;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request> queue;
+    int queuedRows = 0;
+    bool stopping = false;
+    // Open connections; changed only by the I/O thread, under mutex.
+    std::vector<std::shared_ptr<Connection>> connections;
+
+    std::mutex statsMutex;
+    ServerStats totals;
+
+    // Accepts connections, reads requests and sends responses.
+    void ioLoop();
+    // Wakes the I/O thread.
+    void notify();
+    // Sends as much of a connection's output as the socket takes. Returns
+    // false if the connection failed.
+    bool flush(Connection& connection);
+    // Parses the complete requests in a connection's buffer. Returns
+    // false if the connection should be closed.
+    bool parse(std::shared_ptr<Connection>& connection);
+    // Collects and runs batches of requests.
+    void workerLoop();
+    // Queues the response to a request on its connection.
+    void respond(Request& request, Status status, const double* probs);
+  };
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef LAYER_HH
+#define LAYER_HH
+
+#include <stdint.h>
+#include <vector>
+
+namespace ANN
+{
+  // Activation applied to the sums of a layer.
+  enum class Activation
+  {
+    Tanh,
+    // Sums are left as they are (softmax is applied by the network).
+    Linear
+  };
+
+  // A fully connected layer computing activation(x * W + b).
+  //
+  // The weights (inputs x outputs, row-major) and the biases live in one
+  // contiguous slab, weights first, so that a layer can be copied, saved
+  // or mapped as a single block. Every kernel works on a range of rows
+  // or columns so the work can be split between threads. Where columns
+  // is given, only those output columns take part and the values, grads
+  // and partial sums are packed in the order of columns.
+  class Layer
+  {
+  public:
+    Layer(int inputs = 0, int outputs = 0, Activation activation = Activation::Tanh);
+
+    int inputs;
+    int outputs;
+    Activation activation;
+
+    // Weights followed by biases.
+    std::vector<double> params;
+    // Deltas from the previous update, laid out like params.
+    std::vector<double> prevDelta;
+    // Activations from the last forward pass.
+    std::vector<double> values;
+    // Gradients with respect to this layer's sums.
+    std::vector<double> grads;
+
+    // 1 for weights kept by pruning, 0 for weights held at zero. Empty
+    // unless the layer has been pruned.
+    std::vector<uint8_t> mask;
+    // Non-zero weights in compressed sparse rows, one row per input: the
+    // weights of input i are sparseWeights[rowStart[i], rowStart[i + 1])
+    // in the columns given by columnIndex. Empty until compress().
+    std::vector<int> rowStart;
+    std::vector<int> columnIndex;
+    std::vector<double> sparseWeights;
+
+    // Returns the number of parameters (weights and biases).
+    int size();
+    double* weights();
+    double* biases();
+
+    // Fused matmul, bias and activation for output columns [begin, end).
+    void forward(const double* x, int begin, int end);
+    // Runs rows samples at once: y (rows x outputs) = activation(x * W + b)
+    // for x (rows x inputs), both row-major.
+    void forwardBatch(const double* x, int rows, double* y);
+    // Same, for weights and biases laid out as in params but held
+    // elsewhere (e.g. by a Model).
+    static void forwardBatch(const double* params, int inputs, int outputs, Activation activation,
+      const double* x, int rows, double* y);
+    // Adds the contribution of input rows [begin, end) to partial, one
+    // sum per output column.
+    void forwardPartial(const double* x, double* partial, int begin, int end, const int* columns = nullptr, int count = 0);
+    // Sums the partials of each worker into values, then adds biases and
+    // applies the activation.
+    void reduce(const double* partials, int workers, int stride, const int* columns = nullptr, int count = 0);
+    // Back-propagates grads to the previous layer for its nodes
+    // [begin, end), given that layer's (tanh) values.
+    void backward(const double* prevValues, double* prevGrads, int begin, int end, const int* columns = nullptr, int count = 0);
+    // Updates weight rows [begin, end) using the layer's input x.
+    void updateWeights(const double* x, double learnRate, double momentum, double weightDecay, int begin, int end, const int* columns = nullptr, int count = 0);
+    // Updates biases [begin, end) (indices into columns when given).
+    void updateBiases(double learnRate, double momentum, double weightDecay, int begin, int end, const int* columns = nullptr);
+
+    // Zeroes the given fraction of weights with the smallest magnitude and
+    // marks them in mask so that updates leave them at zero. Returns the
+    // number of weights kept.
+    int prune(double sparsity);
+    // Builds the compressed sparse rows from the current weights.
+    void compress();
+    // Drops the mask and the compressed rows.
+    void densify();
+    // Sparse counterpart of forward for a whole sample, writing to y.
+    // Inputs of zero are skipped.
+    void forwardSparse(const double* x, double* y);
+
+    // Applies the activation function to a single sum.
+    double activate(double x);
+    static double activate(Activation activation, double x);
+  };
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef MATRIX_HH
 #define MATRIX_HH
 
+#include "text-writer.hh"
 #include <node.h>
 #include <string>
 #include <vector>
@@ -26,6 +27,8 @@ public:
 
 	// Returns a string representation of the matrix.
 	std::string toString(int precision = 6, bool verbose = false, int padding = 0);
+	// Writes the same representation to out.
+	void write(TextWriter& out, int precision = 6, bool verbose = false, int padding = 0);
 	// Returns a JS array representation of the matrix.
 	v8::Local<v8::Array> toJSArray(v8::Isolate* isolate);
 
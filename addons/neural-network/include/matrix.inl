@@ -65,21 +65,25 @@ T Matrix<T>::get(int i, int j)
 template <typename T>
 std::string Matrix<T>::toString(int precision, bool verbose, int padding)
 {
-	std::string output = "";
+	TextWriter output;
+	write(output, precision, verbose, padding);
+	return output.str();
+}
+
+template <typename T>
+void Matrix<T>::write(TextWriter& out, int precision, bool verbose, int padding)
+{
 	for (int i = 0; i < this->row_count; i++)
 	{
-		std::string row = "";
+		if (verbose) out.write("[ ", 2);
 		for (int j = 0; j < this->col_count; j++)
 		{
-			if (j > 0) row += " ";
-			std::string item = tools::toString(matrix[i][j], precision);
-			if (padding > item.length()) item.insert(item.begin(), padding - item.length(), ' ');
-			row += item;
+			if (j > 0) out.write(' ');
+			out.writeNumber(matrix[i][j], precision, padding);
 		}
-		if (verbose) row = "[ " + row + " ]";
-		output += row + "\n";
+		if (verbose) out.write(" ]", 2);
+		out.write('\n');
 	}
-	return output;
 }
 
 template <typename T>
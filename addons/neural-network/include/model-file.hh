@@ -0,0 +1,88 @@
+#ifndef MODEL_FILE_HH
+#define MODEL_FILE_HH
+
+#include "layer.hh"
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ANN
+{
+  // A network's weights in the binary model format, mapped into memory.
+  //
+  // Layout (little-endian):
+  //   0   magic "ANNMODEL"
+  //   8   uint32 format version (VERSION)
+  //   12  uint32 dtype of the weights (1: float64)
+  //   16  uint32 number of layers, L
+  //   20  uint32 block alignment (ALIGN)
+  //   24  uint64 file length in bytes
+  //   32  uint64 checksum of everything after the header
+  //   64  uint32 layer sizes (L + 1, input layer first), then uint32
+  //       activation of each layer (L)
+  // followed by one block per layer holding its weights (inputs x
+  // outputs, row-major) then its biases, as in Layer::params. Sections
+  // start on ALIGN byte boundaries and are zero padded, so mapped blocks
+  // can be used in place.
+  class ModelFile
+  {
+  public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t ALIGN = 64;
+
+    ~ModelFile();
+    ModelFile(const ModelFile&) = delete;
+    ModelFile& operator=(const ModelFile&) = delete;
+
+    // Writes layers to path, replacing it in one step. Returns false and
+    // sets error on failure.
+    static bool write(const std::string& path, const std::vector<Layer>& layers, std::string& error);
+    // Same for layers given by topology, the activation of each layer and
+    // a pointer to each layer's weights and biases.
+    static bool write(const std::string& path, const std::vector<int>& topology,
+      const std::vector<Activation>& activations, const std::vector<const double*>& params, std::string& error);
+    // Returns the contents of the file write() would write.
+    static std::vector<uint64_t> image(const std::vector<Layer>& layers);
+    static std::vector<uint64_t> image(const std::vector<int>& topology,
+      const std::vector<Activation>& activations, const std::vector<const double*>& params);
+    // Returns whether the file at path starts with the magic bytes.
+    static bool detect(const std::string& path);
+    // Maps the file at path (reading it once where mapping is not
+    // available) and checks its header and checksum. Returns NULL and
+    // sets error if it cannot be used.
+    static std::shared_ptr<const ModelFile> open(const std::string& path, std::string& error);
+
+    // Checks a file already in memory (of up to capacity bytes) and uses
+    // it in place. The memory must outlive the result.
+    static std::shared_ptr<const ModelFile> view(const void* data, size_t capacity, std::string& error);
+
+    // Number of nodes in each layer, input layer first.
+    const std::vector<int>& topology() const;
+    Activation activation(int l) const;
+    // Weights followed by biases of layer l, in place in the file.
+    const double* params(int l) const;
+  private:
+    ModelFile();
+
+    // Start and length of the file's contents.
+    const char* data = nullptr;
+    size_t length = 0;
+    // Whether data is a mapping (otherwise it points into buffer, or into
+    // memory owned elsewhere).
+    bool mapped = false;
+    std::vector<uint64_t> buffer;
+
+    std::vector<int> sizes;
+    std::vector<Activation> activations;
+    std::vector<size_t> offsets;
+
+    // Finds the sections of a file of length bytes and checks them.
+    bool parse(std::string& error);
+    // Returns the checksum of count 8-byte words.
+    static uint64_t checksum(const uint64_t* words, size_t count);
+  };
+}
+
+#endif
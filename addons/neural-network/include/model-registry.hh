@@ -0,0 +1,93 @@
+#ifndef MODEL_REGISTRY_HH
+#define MODEL_REGISTRY_HH
+
+#include "model.hh"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <node.h>
+#include <node_object_wrap.h>
+#include <string>
+#include <unordered_map>
+
+namespace ANN
+{
+  using v8::Function;
+  using v8::FunctionCallbackInfo;
+  using v8::Local;
+  using v8::Object;
+  using v8::Persistent;
+  using v8::Value;
+
+  // Maps model ids to files written by NeuralNetwork.saveBinary() or
+  // NeuralNetwork.save().
+  //
+  // A model is read the first time it is used and kept resident until the
+  // weights of all resident models exceed the memory budget, when the least
+  // recently used ones are dropped (to be read again on their next use).
+  // Lookups may come from several threads at once; a model in use by one
+  // stays valid even if another evicts it.
+  class ModelRegistry : public node::ObjectWrap
+  {
+  public:
+    static void Init(Local<Object> exports);
+
+    // Returns the model registered as id, reading it if it is not
+    // resident. Returns NULL and sets error if id is unknown or its file
+    // cannot be read.
+    std::shared_ptr<const Model> acquire(const std::string& id, std::string& error);
+  private:
+    static Persistent<Function> constructor;
+    static void New(const FunctionCallbackInfo<Value>& args);
+
+    // Memory budget used when none is given (256 MiB).
+    static const size_t DEFAULT_BUDGET = (size_t)256 << 20;
+
+    struct Entry
+    {
+      std::string path;
+      // NULL while not resident.
+      std::shared_ptr<const Model> model;
+      size_t bytes = 0;
+      // Position in recency while resident.
+      std::list<std::string>::iterator use;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    // Ids of resident models, most recently used first.
+    std::list<std::string> recency;
+    size_t budget;
+    size_t resident = 0;
+    long long loads = 0;
+    long long hits = 0;
+    long long evictions = 0;
+
+    explicit ModelRegistry(size_t budget);
+
+    // :: PUBLICLY AVAILABLE FUNCTIONS :: //
+    // Registers the file at a path under an id, replacing any model
+    // already registered under it.
+    static void Register(const FunctionCallbackInfo<Value>& args);
+    // Forgets an id. Returns whether it was registered.
+    static void Unregister(const FunctionCallbackInfo<Value>& args);
+    // Runs rows through the model registered under an id. Takes the same
+    // rows and 'argmax' option as NeuralNetwork.predict().
+    static void Predict(const FunctionCallbackInfo<Value>& args);
+    // Returns { registered, resident, bytes, budget, loads, hits,
+    // evictions }.
+    static void Stats(const FunctionCallbackInfo<Value>& args);
+
+    // :: PRIVATE FUNCTIONS :: //
+    // Maps a model from a file written by saveBinary(), or reads one
+    // written by save().
+    static std::shared_ptr<const Model> Load(const std::string& path, std::string& error);
+    // Makes entry resident and most recently used. Call with mutex held.
+    void Admit(const std::string& id, Entry& entry, std::shared_ptr<const Model> model);
+    // Drops least recently used models, other than keep, until resident
+    // fits the budget. Call with mutex held.
+    void Evict(const std::string& keep);
+  };
+}
+
+#endif
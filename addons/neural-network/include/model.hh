@@ -0,0 +1,92 @@
+#ifndef MODEL_HH
+#define MODEL_HH
+
+#include "layer.hh"
+#include "model-file.hh"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ANN
+{
+  // An immutable copy of a network's weights for inference.
+  //
+  // Nothing in a Model changes after construction, so any number of
+  // threads may call predict() on the same one at once as long as each
+  // passes its own scratch.
+  class Model
+  {
+  public:
+    // Number of samples pushed through the layers together.
+    static const int BLOCK = 64;
+
+    explicit Model(std::vector<Layer>& layers);
+    // Uses the weights of a model file in place.
+    explicit Model(std::shared_ptr<const ModelFile> file);
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    int numInput() const;
+    int numOutput() const;
+    // Number of nodes in each layer, input layer first.
+    const std::vector<int>& sizes() const;
+    // Returns the memory held by the weights and biases.
+    size_t bytes() const;
+
+    // Writes numOutput class probabilities for each of rows samples in x
+    // (row-major, numInput values each) to probs. scratch is grown as
+    // needed and can be reused between calls.
+    void predict(const double* x, int rows, double* probs, std::vector<double>& scratch) const;
+    // Same, using scratch owned by the calling thread.
+    void predict(const double* x, int rows, double* probs) const;
+  private:
+    // Number of nodes in each layer, input layer first.
+    std::vector<int> topology;
+    std::vector<Activation> activations;
+    // Weights followed by biases, as in Layer::params, when copied.
+    std::vector<std::vector<double>> params;
+    // Otherwise the file holding them.
+    std::shared_ptr<const ModelFile> file;
+    // Start of each layer's weights in params or file.
+    std::vector<const double*> blocks;
+  };
+
+  // Hands the latest Model to concurrent readers, read-copy-update style.
+  //
+  // A writer publishes a new snapshot by swapping the pointer; readers
+  // that already hold the old one keep using it, and it is freed when the
+  // last of them lets go. Readers never wait for a writer to finish
+  // building a snapshot.
+  //
+  // load() takes no lock: a reader counts itself in under the current
+  // epoch while it copies the pointer. publish() swaps the pointer,
+  // starts a new epoch and waits for the readers of the old one, which
+  // only take a few instructions, before dropping its reference.
+  class ModelHandle
+  {
+  public:
+    explicit ModelHandle(std::shared_ptr<const Model> model);
+    ~ModelHandle();
+    ModelHandle(const ModelHandle&) = delete;
+    ModelHandle& operator=(const ModelHandle&) = delete;
+
+    // Returns the current snapshot.
+    std::shared_ptr<const Model> load() const;
+    // Replaces the current snapshot.
+    void publish(std::shared_ptr<const Model> model);
+    // Returns the number of snapshots published so far.
+    long long version() const;
+  private:
+    // The handle's own reference to the current snapshot.
+    std::atomic<const std::shared_ptr<const Model>*> current;
+    std::atomic<unsigned int> epoch;
+    // Readers inside load(), by the parity of their epoch.
+    mutable std::atomic<int> readers[2];
+    // Held by publish() so that writers take turns.
+    std::mutex writing;
+    std::atomic<long long> published;
+  };
+}
+
+#endif
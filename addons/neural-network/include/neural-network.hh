@@ -1,15 +1,34 @@
 #ifndef NEURAL_NETWORK_HH
 #define NEURAL_NETWORK_HH
 
+#include "checkpoint.hh"
+#include "epoch-log.hh"
+#include "importance-sampler.hh"
+#include "inference-server.hh"
+#include "layer.hh"
 #include "matrix.hh"
+#include "model.hh"
+#include "prediction-cache.hh"
+#include "quantized-layer.hh"
 #include "random.hh"
+#include "shared-model.hh"
+#include "snapshot-writer.hh"
+#include "text-writer.hh"
+#include "thread-pool.hh"
+#include "training-metrics.hh"
+#include <map>
+#include <memory>
 #include <node.h>
 #include <node_object_wrap.h>
+#include <uv.h>
 #include <vector>
 
 namespace ANN
 {
+  class DataClass;
+
   using v8::Array;
+  using v8::ArrayBuffer;
   using v8::Function;
   using v8::FunctionCallbackInfo;
   using v8::Isolate;
@@ -20,8 +39,14 @@ namespace ANN
 
   class NeuralNetwork : public node::ObjectWrap
   {
+    // Build, train and read networks directly.
+    friend class Ensemble;
+    friend class Model;
+    friend class ModelRegistry;
+    friend class SharedNetwork;
   public:
     static void Init(Local<Object> exports);
+    ~NeuralNetwork();
   private:
     static Persistent<Function> constructor;
     static void New(const FunctionCallbackInfo<Value>& args);
@@ -32,61 +57,220 @@ namespace ANN
     double momentum = 0.0;
     double weightDecay = 0.0;
 
-    // Number of input, hidden, and output nodes.
+    // Number of weights above which the intra-sample parallel mode is
+    // switched on automatically.
+    static const int PARALLEL_THRESHOLD = 1 << 16;
+    // Minimum number of nodes of a layer given to each thread. Narrower
+    // layers are split by their inputs instead.
+    static const int PARALLEL_MIN_HIDDEN = 64;
+    // Layers with up to this many weights are written out fully unrolled
+    // by exportCpp(); larger ones are written as loops.
+    static const int EXPORT_UNROLL_LIMIT = 1024;
+    // Number of samples pushed through the layers together by predict().
+    static const int PREDICT_BLOCK = 64;
+    // Above this many classes the confusion matrix is listed by cell
+    // rather than drawn as a table.
+    static const int CONFUSION_TABLE_LIMIT = 32;
+
+    // Number of negative classes sampled per training sample when using
+    // sampled softmax. Zero trains against the full softmax.
+    int numSampled = 0;
+
+    // Pool used to split the nodes of each layer between threads. NULL
+    // when running single-threaded.
+    std::unique_ptr<ThreadPool> pool;
+
+    // Number of nodes in each layer, input layer first.
+    std::vector<int> topology;
+    // Number of input and output nodes.
     int numInput;
-    int numHidden;
     int numOutput;
 
     // Vector of inputs.
     std::vector<double> inputs;
 
-    // Input-hidden weights.
-    Matrix<double> ihWeights;
-    // Hidden biases.
-    std::vector<double> hBiases;
-    // Hidden output.
-    std::vector<double> hOutputs;
-
-    // Hidden-output weights.
-    Matrix<double> hoWeights;
-    // Output biases.
-    std::vector<double> oBiases;
+    // Dense layers, from the first hidden layer to the output layer.
+    // Every hidden layer uses tanh; the output layer leaves its sums for
+    // the softmax.
+    std::vector<Layer> layers;
 
     // Vector of outputs.
     std::vector<double> outputs;
+    // Per-thread partial sums for layers split by their inputs.
+    std::vector<double> partials;
+    // Number of entries in partials given to each thread.
+    int partialStride = 0;
+
+    // Sampled softmax specific arrays.
+    // Classes taking part in the current training sample (target first).
+    // Empty unless a sampled training step is in progress.
+    std::vector<int> sampledClasses;
+    // Marks classes already drawn for the current sample.
+    std::vector<int> sampledStamp;
+    int stamp = 0;
+
+    // Int8 copies of the layers made by quantize(). While not empty,
+    // predict() and predictInto() use these instead of the layers.
+    // Training drops them.
+    std::vector<QuantizedLayer> quantized;
+    // Scratch for quantizing a sample's inputs in predictInto().
+    std::vector<int8_t> quantizedScratch;
+    // Whether prune() has switched prediction to the layers' compressed
+    // sparse rows. Training switches back to dense weights.
+    bool sparse = false;
+    // Two buffers as long as the widest layer, for running one sample
+    // through the quantized or sparse layers in predictInto().
+    std::vector<double> sampleValues;
+
+    // Latest snapshot of the weights for readers on other threads (the
+    // server). NULL until something reads snapshots; after that the
+    // weights are published whenever they change.
+    std::shared_ptr<ModelHandle> models;
+    // Cache of predictions in front of predict() and predictInto(). NULL
+    // unless enabled with predictCache(). Cleared whenever the weights
+    // change.
+    std::unique_ptr<PredictionCache> cache;
+    // Server started by serve(). NULL when not serving.
+    std::unique_ptr<InferenceServer> server;
+    // Shared memory segment made by publishShared(). NULL unless
+    // publishing; after that the weights are published whenever they
+    // change.
+    std::unique_ptr<SharedModel> shared;
 
-    // Back-propagation specific array.
-    // These could be local to function updateWeights().
-    // Output and hidden gradients for back-propagation.
-    std::vector<double> oGrads;
-    std::vector<double> hGrads;
+    // Writes the snapshots requested by train()'s snapshot options. NULL
+    // until they are first used.
+    std::unique_ptr<SnapshotWriter> snapshots;
 
-    // Back-propagation momentum specific arrays.
-    // These could be local to function train().
-    // For momentum with back-propagation.
-    Matrix<double> ihPrevWeightsDelta;
-    std::vector<double> hPrevBiasesDelta;
-    Matrix<double> hoPrevWeightsDelta;
-    std::vector<double> oPrevBiasesDelta;
+    // Loss-based row sampler used by train() when requested. NULL when
+    // every row is visited once per epoch.
+    std::unique_ptr<ImportanceSampler> sampler;
 
     // Holds training accuracy from the last training run.
     std::vector<double> trainingAccuracy;
     // Holds the testing accuracy from the last training run.
     std::vector<double> testingAccuracy;
+    // Epochs completed by the last training run.
+    int epoch = 0;
+    // Order of the training rows after the last shuffle.
+    std::vector<int> order;
+    // Set by resume(): the next train() carries on from epoch, order and
+    // the accuracy history rather than starting over. Losses for the
+    // importance sampler are held until it is created.
+    bool resumed = false;
+    std::vector<double> resumedLosses;
 
-    // Used as a temporary holder.
-    Matrix<int> confusionMatrix;
+    // Ring of per-epoch metrics over the buffer returned by metrics(),
+    // which is held here for as long as it is written to. NULL until
+    // metrics() is called.
+    std::unique_ptr<TrainingMetrics> metrics;
+    Persistent<ArrayBuffer> metricsBuffer;
+    // Set while trainAsync() runs; the network is off limits until then.
+    bool training = false;
+    // trainAsync() calls in progress on any network. They share the
+    // random generator, so nothing else may use, seed or restore it
+    // meanwhile.
+    static int asyncRuns;
 
-    NeuralNetwork(int numInput, int numHidden, int numOutput);
+    // Used as a temporary holder. Maps (expected, predicted) to a count,
+    // so only the cells that occur are stored.
+    std::map<std::pair<int, int>, int> confusionMatrix;
+
+    // Rows to run through predict(). Exactly one of f64, f32 and matrix
+    // is set; typed array rows hold numInput values, matrix rows hold at
+    // least numInput (any targets after them are ignored).
+    struct PredictInput
+    {
+      const double* f64 = nullptr;
+      const float* f32 = nullptr;
+      Matrix<double>* matrix = nullptr;
+      int rows = 0;
+    };
+
+    // Arguments of train(), read up front so that a run can go on without
+    // touching JavaScript.
+    struct TrainSettings
+    {
+      DataClass* train = nullptr;
+      DataClass* test = nullptr;
+      int maxEpochs = 0;
+      double learnRate = 0.0;
+      std::string logFileName;
+      int publishEvery = 0;
+      std::string checkpointPath;
+      int checkpointEvery = 1;
+      std::string snapshotPath;
+      int snapshotEvery = 0;
+      bool snapshotOnBest = false;
+      int snapshotBuffers = 2;
+      SnapshotPolicy snapshotPolicy = SnapshotPolicy::Drop;
+      std::string cachePath;
+      long long cacheBytes = 0;
+      LogFormat logFormat = LogFormat::Text;
+      std::vector<LogColumn> logColumns;
+      int logFlushMillis = 1000;
+      // Whether to use the importance sampler, and its settings.
+      bool importance = false;
+      double sampleFraction = 1.0;
+      double uniformMix = 0.1;
+    };
+    // A trainAsync() call in progress.
+    struct TrainJob;
+
+    explicit NeuralNetwork(const std::vector<int>& topology);
 
     // :: PUBLICLY AVAILABLE FUNCTIONS :: //
     // Returns a string representation of the Neural Network.
     static void ToString(const FunctionCallbackInfo<Value>& args);
     //static void InitialiseWeights(const FunctionCallbackInfo<Value>& args);
     static void Train(const FunctionCallbackInfo<Value>& args);
+    // Same as train() on the libuv thread pool, taking a callback as the
+    // last argument. The callback gets an error (or null) and whether the
+    // result came from the cache. The run works on copies of the data.
+    // Until it ends, other calls on the network throw.
+    static void TrainAsync(const FunctionCallbackInfo<Value>& args);
+    // Returns an ArrayBuffer of float64 values that train() and
+    // trainAsync() write each epoch's metrics to (see TrainingMetrics),
+    // for reading through a Float64Array while training runs. Takes the
+    // number of epochs the ring holds (default 1024).
+    static void Metrics(const FunctionCallbackInfo<Value>& args);
     static void ConfusionToString(const FunctionCallbackInfo<Value>& args);
     static void Accuracy(const FunctionCallbackInfo<Value>& args);
     static void MomentumAndDecay(const FunctionCallbackInfo<Value>& args);
+    // Returns the class probabilities of each row as a Float64Array, or
+    // with 'argmax' as a second argument, the winning class of each row as
+    // an Int32Array. Accepts a DataClass, a Float64Array/Float32Array of
+    // row-major inputs, or an array of rows.
+    static void Predict(const FunctionCallbackInfo<Value>& args);
+    // Low-latency single sample prediction: reads numInput values from a
+    // Float64Array/Float32Array and writes numOutput probabilities into
+    // another. Nothing is allocated and nothing is thrown; returns false
+    // if the arguments are unusable or the network is training.
+    static void PredictInto(const FunctionCallbackInfo<Value>& args);
+    // Derives int8 weights and per-layer scales from a calibration
+    // DataClass and switches prediction to them. Returns the float and
+    // quantized accuracy on the calibration data and the size of each
+    // model in bytes.
+    static void Quantize(const FunctionCallbackInfo<Value>& args);
+    // Puts a least-recently-used cache of the given number of rows in
+    // front of predict() and predictInto(). Zero removes it.
+    static void PredictCacheSize(const FunctionCallbackInfo<Value>& args);
+    // Returns the cache's hits, misses, size and capacity (null when there
+    // is no cache).
+    static void CacheStats(const FunctionCallbackInfo<Value>& args);
+    // Zeroes the smallest weights of each layer and switches prediction to
+    // a sparse kernel. Takes an options object:
+    //   sparsity        fraction of weights to remove (0 to 1)
+    //   finetuneEpochs  epochs of masked retraining afterwards (default 0)
+    //   train           DataClass to retrain on
+    //   learnRate       learning rate for retraining (default 0.01)
+    // Returns the number of weights and how many are left non-zero.
+    static void Prune(const FunctionCallbackInfo<Value>& args);
+    // Sets the number of threads used within a single sample. Zero (the
+    // default) picks a count based on the size of the network.
+    static void Threads(const FunctionCallbackInfo<Value>& args);
+    // Sets the number of negative classes sampled for each training
+    // sample. Zero (the default) trains against the full softmax.
+    static void SampledSoftmax(const FunctionCallbackInfo<Value>& args);
 
     // Returns a JavaScript array containing the training accuracy from
     // the last training run.
@@ -98,30 +282,171 @@ namespace ANN
     // Saves a basic set of information about the Neural Network to the
     // specified file.
     // If a second argument is passed as the boolean true, a much more
-    // verbose set of information will be written.
+    // verbose set of information will be written. A third sets the
+    // decimal places, or 'shortest' writes each weight exactly.
     static void Save(const FunctionCallbackInfo<Value>& args);
+    // Writes the weights at full precision in the binary model format
+    // (see ModelFile) to the given path.
+    static void SaveBinary(const FunctionCallbackInfo<Value>& args);
+    // Returns a new NeuralNetwork read from a file written by saveBinary()
+    // or by save() without verbose.
+    static void Load(const FunctionCallbackInfo<Value>& args);
+    // Writes the full training state to the given path: weights, momentum
+    // terms, epoch, accuracy history, row order, the random generator and
+    // the sampler's losses.
+    static void SaveCheckpoint(const FunctionCallbackInfo<Value>& args);
+    // Restores a state written by checkpoint() (or by train() with the
+    // checkpoint option), so that the next train() call with the same
+    // data and arguments carries on as if it had never stopped. Returns
+    // the number of epochs already completed.
+    static void Resume(const FunctionCallbackInfo<Value>& args);
+    // Publishes the weights to a named shared memory segment for other
+    // processes to attach to with NeuralNetwork.attachShared(name). Later
+    // calls, and any change of the weights, publish a new generation.
+    // Returns the number of generations published.
+    static void PublishShared(const FunctionCallbackInfo<Value>& args);
+    // Returns a SharedNetwork attached to a segment written by
+    // publishShared(), running inference on the weights in place.
+    static void AttachShared(const FunctionCallbackInfo<Value>& args);
+    // Seeds the random generators used for initial weights, shuffling and
+    // splitting data, so that runs repeat exactly (and can be served by
+    // train()'s result cache).
+    static void Seed(const FunctionCallbackInfo<Value>& args);
+    // Returns { written, dropped, failed, pending, error } for the
+    // snapshots taken by train(), or null if it has taken none.
+    static void SnapshotStats(const FunctionCallbackInfo<Value>& args);
+
+    // Writes the network to a self-contained C++ header holding the
+    // weights as constexpr arrays and a predict() specialised for the
+    // topology. An optional options object takes:
+    //   namespace  namespace of the generated code (default "model")
+    //   precision  significant digits of each weight (default 17)
+    // At 17 digits the header sums in the same order as the built-in BLAS
+    // backend on one thread, and then matches predict() bit for bit; other
+    // backends and thread counts may differ in the last bits.
+    static void ExportCpp(const FunctionCallbackInfo<Value>& args);
+
+    // Serves predictions from a snapshot of the current weights on a
+    // local socket. Takes an options object:
+    //   socket         path of a Unix domain socket to listen on
+    //   port           localhost TCP port when no socket is given (0 for
+    //                  any free port)
+    //   maxBatch       most rows per batch (default 64)
+    //   maxWaitMicros  longest a request waits for a batch (default 200)
+    //   workers        threads running batches (default 2)
+    // Returns the TCP port (0 for a Unix socket).
+    static void Serve(const FunctionCallbackInfo<Value>& args);
+    // Returns the server's counters, queue depth and latency histogram.
+    static void ServerStats(const FunctionCallbackInfo<Value>& args);
+    // Stops the server, if any.
+    static void StopServer(const FunctionCallbackInfo<Value>& args);
+
+    // Returns the name of the linear algebra backend in use.
+    static void BlasBackend(const FunctionCallbackInfo<Value>& args);
+    // Loads a CBLAS shared library from the given path, returning whether
+    // it succeeded. Without a path, reverts to the build-time backend.
+    static void LoadBlas(const FunctionCallbackInfo<Value>& args);
 
     // :: PRIVATE FUNCTIONS :: //
+    // Returns the layers of a network with the given topology: tanh
+    // hidden layers and a linear output layer (softmax is applied after).
+    static std::vector<Layer> MakeLayers(const std::vector<int>& topology);
+    // Reads a file written by save() (without verbose) into topology and
+    // weights, in the order taken by SetWeights. Returns false and sets
+    // error if the file is missing or malformed.
+    static bool ReadSaved(const std::string& path, std::vector<int>& topology, std::vector<double>& weights, std::string& error);
     void InitialiseWeights();
+    // Reads the first count arguments of train() into settings. Throws and
+    // returns false if they are unusable.
+    static bool ReadTrainSettings(const FunctionCallbackInfo<Value>& args, int count, TrainSettings& settings);
+    // Trains nn as set out by settings, without touching JavaScript.
+    // Sets cached if the result came from the cache. Returns false and
+    // sets error if a file could not be written or a resumed state does
+    // not fit the run.
+    static bool RunTraining(NeuralNetwork* nn, const TrainSettings& settings, bool& cached, std::string& error);
+    static void TrainWork(uv_work_t* request);
+    static void TrainDone(uv_work_t* request, int status);
+    // Throws and returns true if nn is busy with trainAsync().
+    static bool Busy(Isolate* isolate, NeuralNetwork* nn);
+    // Returns the current training state.
+    Checkpoint TrainingState();
+    // Restores a training state. Returns false and sets error if it does
+    // not fit this network.
+    bool RestoreTrainingState(const Checkpoint& state, std::string& error);
     std::vector<double> GetWeights();
     void SetWeights(std::vector<double>& weights);
     void UpdateWeights(std::vector<double>& tValues, double learnRate);
 
     std::vector<double> ComputeOutputs(std::vector<double>& xValues);
+    // Runs every layer on inputs. The output layer's values are left as
+    // sums of the active classes (all, or sampledClasses).
+    void Forward();
+    // Returns an immutable copy of the current weights.
+    std::shared_ptr<const Model> Snapshot();
+    // Publishes a snapshot of the current weights to models and to shared
+    // memory, where in use.
+    void Publish();
+    // Runs one sample through the quantized layers, ping-ponging between
+    // a and b (each as long as the widest layer). Returns the output sums.
+    const double* QuantizedForward(const double* x, double* a, double* b, int8_t* scratch);
+    // Same for the compressed sparse rows of the layers.
+    const double* SparseForward(const double* x, double* a, double* b);
+    // Reads the rows accepted by predict() from value into input, copying
+    // JavaScript arrays into copy. Throws and returns false if value is
+    // not usable.
+    static bool ReadPredictInput(Isolate* isolate, Local<Value> value, int numInput, PredictInput& input, std::vector<double>& copy);
+    // Copies the first numInput values of a row of input to x.
+    static void CopyRow(const PredictInput& input, int row, int numInput, double* x);
+    // Returns a pointer to the elements of a Float64Array or Float32Array
+    // and sets length and isDouble, or returns NULL for any other value.
+    static void* TypedArrayData(Local<Value> value, int& length, bool& isDouble);
+    // Runs the rows of input through the network PREDICT_BLOCK at a time,
+    // writing numOutput probabilities per row to probs and/or the winning
+    // class per row to labels (either may be NULL). Blocks are shared
+    // between the pool's workers.
+    void PredictBatch(const PredictInput& input, double* probs, int* labels);
+    // Back-propagates the output layer's grads and updates all weights.
+    void Backward(double learnRate);
+    // Trains on a single sample using sampled softmax with cross entropy,
+    // touching only the target class and numSampled other classes.
+    // Returns the cross entropy of the sample over the sampled classes.
+    double UpdateWeightsSampled(std::vector<double>& xValues, int target, double learnRate);
+    // Draws the classes for a sampled training step into sampledClasses.
+    void SampleClasses(int target);
+
+    // Creates (or removes) the thread pool. A count of zero picks one
+    // automatically.
+    void SetThreads(int count);
+    // Returns the number of workers taking part in each pass.
+    int Workers();
+    // Returns whether layer l is split between workers by its outputs
+    // (otherwise by its inputs, with partial sums).
+    bool SplitByOutputs(int l);
+    // Waits for the other workers when running in parallel.
+    void Sync();
+    // Returns the share [begin, end) of count items for a worker.
+    static void Range(int count, int worker, int workers, int& begin, int& end);
 
     // Private accuracy function.
     double AccuracyHelper(Matrix<double>& testData);
     double MeanSquaredError(Matrix<double>& trainData);
 
-    static double HyperTanFunction(double x);
     static std::vector<double> Softmax(std::vector<double>& oSums);
+    // Softmax of the first count sums, written to result.
+    static void Softmax(const double* oSums, int count, double* result);
     static void Shuffle(std::vector<int>& sequence);
     static int MaxIndex(std::vector<double>& v);
 
     // Helper functions.
     int NumWeights();
+    // Returns the C++ source written by exportCpp().
+    std::string CppSource(const std::string& space, int precision);
     static Local<Array> DoubleVectorToJSArray(Isolate* isolate, std::vector<double>& v);
     static std::string VectorToString(const std::vector<double>& v, int precision = 4, bool verbose = false, int padding = 0);
+    // Formats a row-major block of values like Matrix::toString.
+    static std::string BlockToString(const double* v, int rows, int cols, int precision = 4, bool verbose = false, int padding = 0);
+    // Writes the same to out.
+    static void WriteBlock(TextWriter& out, const double* v, int rows, int cols, int precision, bool verbose, int padding);
   };
 }
 
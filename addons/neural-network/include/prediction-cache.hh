@@ -0,0 +1,77 @@
+#ifndef PREDICTION_CACHE_HH
+#define PREDICTION_CACHE_HH
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace ANN
+{
+  // A bounded least-recently-used cache of class probabilities keyed by
+  // input row.
+  //
+  // Rows are quantized to single precision before hashing and comparing,
+  // so rows that agree to float precision share an entry. Entries live in
+  // fixed slots linked in recency order and are found through an
+  // open-addressing table of at least twice as many positions. All of it
+  // is allocated up front, so find() and insert() never allocate. Safe to
+  // use from several threads at once.
+  class PredictionCache
+  {
+  public:
+    PredictionCache(int capacity, int numInput, int numOutput);
+
+    // Copies the cached probabilities of x to probs and returns true, or
+    // returns false if x is not cached.
+    bool find(const double* x, double* probs);
+    // Caches the probabilities of x, evicting the least recently used
+    // entry when full.
+    void insert(const double* x, const double* probs);
+    // Drops every entry (hit and miss counts are kept).
+    void clear();
+
+    int capacity();
+    int size();
+    long long hits();
+    long long misses();
+  private:
+    int slots;
+    int numInput;
+    int numOutput;
+
+    std::mutex mutex;
+    long long hitCount = 0;
+    long long missCount = 0;
+
+    // Per slot: quantized key, probabilities, hash, and recency links.
+    std::vector<float> keys;
+    std::vector<double> values;
+    std::vector<uint64_t> hashes;
+    std::vector<int> prev;
+    std::vector<int> next;
+    // Most and least recently used slots (-1 when empty).
+    int head = -1;
+    int tail = -1;
+    // Number of slots in use.
+    int used = 0;
+    // Open-addressing table (linear probing) of slots, -1 where empty; its
+    // size is a power of two and mask is one less.
+    std::vector<int> table;
+    size_t mask;
+    // Quantized key of the row being looked up (guarded by mutex).
+    std::vector<float> scratch;
+
+    // Quantizes x into scratch and returns its hash.
+    uint64_t hash(const double* x);
+    // Returns the table position holding the slot whose key is scratch,
+    // or the empty position where it would go.
+    size_t locate(uint64_t h);
+    // Removes a slot from the table.
+    void erase(int slot);
+    void unlink(int slot);
+    void pushFront(int slot);
+  };
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef QUANTIZED_LAYER_HH
+#define QUANTIZED_LAYER_HH
+
+#include "layer.hh"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace ANN
+{
+  // An int8 copy of a Layer used for inference only.
+  //
+  // Weights are quantized symmetrically with one scale for the layer and
+  // stored by output, so each output is a single int8 dot product
+  // accumulated in int32. Inputs are quantized on the fly using a range
+  // measured on calibration data. Rows are zero padded to a multiple of
+  // PADDING so the SIMD loops need no tail handling.
+  class QuantizedLayer
+  {
+  public:
+    static const int PADDING = 32;
+
+    QuantizedLayer() {}
+    // Quantizes layer, given that its inputs stay within +-inputRange.
+    QuantizedLayer(Layer& layer, double inputRange);
+
+    int inputs = 0;
+    int outputs = 0;
+    // Length of a row of weights after padding.
+    int stride = 0;
+    Activation activation = Activation::Tanh;
+
+    // Real values of one int8 step of the inputs and of the weights.
+    double inputScale = 1.0;
+    double weightScale = 1.0;
+    // outputs x stride int8 weights.
+    std::vector<int8_t> weights;
+    // Sum of each row of weights (corrects for unsigned inputs on VNNI).
+    std::vector<int32_t> rowSums;
+    std::vector<double> biases;
+
+    // Returns the number of bytes held by the weights and biases.
+    size_t bytes();
+    // Computes y = activation(x * W + b) for a single sample. scratch must
+    // hold at least stride values.
+    void forward(const double* x, double* y, int8_t* scratch);
+
+    // Returns the name of the dot product kernel compiled in.
+    static const char* kernel();
+  private:
+    int32_t dot(const int8_t* x, int row);
+  };
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define RANDOM_HH
 
 #include <random>
+#include <string>
 
 class Random
 {
@@ -15,6 +16,17 @@ public:
 	double nextDouble();
 	double nextDouble(double upper);
 	double nextDouble(double lower, double upper);
+
+	// Restarts the sequence from the given seed, so that it repeats from
+	// run to run.
+	void seed(unsigned value);
+
+	// Returns the generator's state as text, so the same sequence can be
+	// picked up later with restore().
+	std::string state();
+	// Restores a state returned by state(). Returns false (leaving the
+	// generator as it was) if the text is not a valid state.
+	bool restore(const std::string& state);
 private:
 	std::mt19937 generator;
 	std::uniform_real_distribution<double> distribution;
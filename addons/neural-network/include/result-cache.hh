@@ -0,0 +1,98 @@
+#ifndef RESULT_CACHE_HH
+#define RESULT_CACHE_HH
+
+#include "checkpoint.hh"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ANN
+{
+  // Keeps the outcome of training runs in a directory, so that a run that
+  // has been done before is read back rather than repeated.
+  //
+  // Each entry is named by a hash of everything that decides the run (see
+  // ResultCache::Key) and holds a second hash of the same, the final
+  // training state (a Checkpoint), the log and the mean squared errors of
+  // each epoch. A text file "index" in the directory lists the entries and
+  // their sizes, least recently used first; once the entries exceed the
+  // budget the least recently used are deleted.
+  class ResultCache
+  {
+  public:
+    // Budget used when none is given (64 MiB).
+    static const long long DEFAULT_BUDGET = 64LL << 20;
+
+    // Builds the name of an entry from the inputs of a run: FNV-1a over
+    // the bytes of each value added, in order. A second hash of another
+    // kind is kept in the entry, so that runs whose names collide are not
+    // mistaken for each other.
+    class Key
+    {
+    public:
+      void add(const void* data, size_t length);
+      void add(const std::string& s);
+      template <typename T>
+      void value(T v)
+      {
+        add(&v, sizeof(T));
+      }
+      template <typename T>
+      void vector(const std::vector<T>& v)
+      {
+        value<uint64_t>(v.size());
+        if (!v.empty()) add(v.data(), v.size() * sizeof(T));
+      }
+      // Returns the hash as 16 hex digits.
+      std::string str() const;
+      // Returns the second hash.
+      uint64_t verifier() const;
+    private:
+      uint64_t hash = 14695981039346656037ULL;
+      uint64_t second = 0x9e3779b97f4a7c15ULL;
+    };
+
+    // Opens (creating it if need be) the cache in directory.
+    ResultCache(const std::string& directory, long long budget = DEFAULT_BUDGET);
+
+    // Reads the entry of key into state, log and errors (training and
+    // testing error of each epoch, in pairs) and marks it as most recently
+    // used. Returns false if there is no such entry, it belongs to another
+    // run, or it is damaged (in which case it is dropped).
+    bool get(const Key& key, Checkpoint& state, std::string& log, std::vector<double>& errors);
+    // Stores state, log and errors as the entry of key, then deletes the
+    // least recently used entries until the rest fit the budget. An entry
+    // larger than the whole budget is not stored. Returns false and sets
+    // error if the entry cannot be written.
+    bool put(const Key& key, const Checkpoint& state, const std::string& log,
+      const std::vector<double>& errors, std::string& error);
+
+    // Number of entries and their total size in bytes.
+    int entries();
+    long long bytes();
+  private:
+    static const unsigned VERSION = 3;
+
+    struct Entry
+    {
+      std::string key;
+      long long bytes;
+    };
+
+    std::string directory;
+    long long budget;
+    // Least recently used first.
+    std::vector<Entry> index;
+
+    std::string pathOf(const std::string& key);
+    // Returns the position of key in index, or -1.
+    int find(const std::string& key);
+    // Deletes entry i and its file.
+    void remove(int i);
+    void readIndex();
+    void writeIndex();
+  };
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SHARED_MODEL_HH
+#define SHARED_MODEL_HH
+
+#include "layer.hh"
+#include "model.hh"
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ANN
+{
+  // A network's weights in a named shared memory segment, published by
+  // one process and used in place by any number of others.
+  //
+  // The segment holds a small header and two slots, each large enough for
+  // the model in the binary model format (see ModelFile). The publisher
+  // writes a new generation into the slot readers are not directed to,
+  // then points them at it. Each slot carries a sequence number, odd
+  // while it is being written, which readers check before and after
+  // using the slot (a seqlock): a reader that was overtaken by two
+  // generations simply runs again on the newer one. Readers map the
+  // segment read-only and never copy the weights.
+  //
+  // Only available where POSIX shared memory is (not on Windows).
+  class SharedModel
+  {
+  public:
+    ~SharedModel();
+    SharedModel(const SharedModel&) = delete;
+    SharedModel& operator=(const SharedModel&) = delete;
+
+    // Creates the segment called name for publishing layers and their
+    // later generations, replacing any left over by an earlier
+    // publisher. Returns NULL and sets error on failure.
+    static std::unique_ptr<SharedModel> create(const std::string& name, const std::vector<Layer>& layers, std::string& error);
+    // Maps the segment called name for reading. Returns NULL and sets
+    // error on failure.
+    static std::unique_ptr<SharedModel> attach(const std::string& name, std::string& error);
+
+    const std::string& name() const;
+    // Number of generations published so far.
+    long long generation() const;
+
+    // Publishes layers as the next generation. Fails if their topology
+    // differs from the first generation's.
+    bool publish(const std::vector<Layer>& layers, std::string& error);
+
+    // Writes numOutput class probabilities for each of rows samples in x
+    // to probs, using the latest generation. Returns the generation used,
+    // or -1 (setting error) if nothing usable has been published.
+    long long predict(const double* x, int rows, double* probs, std::string& error);
+    // Returns the topology of the latest generation (empty if none).
+    std::vector<int> topology();
+  private:
+    SharedModel();
+
+    std::string segment;
+    // Whether this process created the segment (and publishes to it).
+    bool owner = false;
+    // Topology fixed for the segment when publishing.
+    std::vector<int> shape;
+    // The mapping, its length and the capacity of each slot.
+    char* base = nullptr;
+    size_t length = 0;
+    size_t slotBytes = 0;
+
+    // Readers: the model found in each slot, and the sequence number it
+    // was read at.
+    std::mutex mutex;
+    std::shared_ptr<const Model> views[2];
+    uint64_t viewed[2] = { 0, 0 };
+
+    // Returns the model in slot as of sequence number sequence, reading
+    // it if it changed. Returns NULL (setting error) if it is unusable.
+    std::shared_ptr<const Model> view(int slot, uint64_t sequence, std::string& error);
+  };
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SHARED_NETWORK_HH
+#define SHARED_NETWORK_HH
+
+#include "shared-model.hh"
+#include <memory>
+#include <node.h>
+#include <node_object_wrap.h>
+
+namespace ANN
+{
+  using v8::Function;
+  using v8::FunctionCallbackInfo;
+  using v8::Local;
+  using v8::Object;
+  using v8::Persistent;
+  using v8::Value;
+
+  // A network published to shared memory by another process (see
+  // NeuralNetwork.publishShared()), attached read-only for inference.
+  class SharedNetwork : public node::ObjectWrap
+  {
+  public:
+    static void Init(Local<Object> exports);
+    // Returns a new SharedNetwork attached to the named segment, as
+    // new SharedNetwork(name) would (so it throws the same way).
+    static void Attach(const FunctionCallbackInfo<Value>& args);
+  private:
+    static Persistent<Function> constructor;
+    static void New(const FunctionCallbackInfo<Value>& args);
+
+    std::unique_ptr<SharedModel> shared;
+    // Number of nodes in each layer, input layer first.
+    std::vector<int> topology;
+
+    explicit SharedNetwork(std::unique_ptr<SharedModel> shared);
+
+    // :: PUBLICLY AVAILABLE FUNCTIONS :: //
+    // Takes the same rows and 'argmax' option as NeuralNetwork.predict(),
+    // using the latest published generation.
+    static void Predict(const FunctionCallbackInfo<Value>& args);
+    // Returns the number of generations published so far.
+    static void Generation(const FunctionCallbackInfo<Value>& args);
+    // Returns the layer sizes, input layer first.
+    static void Topology(const FunctionCallbackInfo<Value>& args);
+  };
+}
+
+#endif
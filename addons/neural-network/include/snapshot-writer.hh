@@ -0,0 +1,85 @@
+#ifndef SNAPSHOT_WRITER_HH
+#define SNAPSHOT_WRITER_HH
+
+#include "layer.hh"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ANN
+{
+  // What submit() does when every buffer is waiting to be written.
+  enum class SnapshotPolicy
+  {
+    // Give up on the new snapshot.
+    Drop,
+    // Wait for the writer to free a buffer.
+    Block
+  };
+
+  // Writes snapshots of a network's weights to disk on a thread of its
+  // own, so that training does not wait on the filesystem.
+  //
+  // submit() copies the weights into one of a fixed number of buffers
+  // (by default two, one filling while the other is written) and queues
+  // it. Each snapshot is written in the binary model format, fsynced and
+  // renamed into place.
+  class SnapshotWriter
+  {
+  public:
+    explicit SnapshotWriter(int buffers = 2, SnapshotPolicy policy = SnapshotPolicy::Drop);
+    // Writes whatever is still queued, then stops the thread.
+    ~SnapshotWriter();
+
+    int buffers();
+    SnapshotPolicy policy();
+
+    // Queues the weights of layers to be written to path. Returns false
+    // if the snapshot was dropped.
+    bool submit(const std::string& path, const std::vector<Layer>& layers);
+    // Waits until every queued snapshot has been written.
+    void flush();
+
+    long long written();
+    long long dropped();
+    long long failed();
+    // Number of snapshots queued or being written.
+    int pending();
+    // Error of the last snapshot that could not be written, if any.
+    std::string lastError();
+  private:
+    struct Buffer
+    {
+      std::string path;
+      std::vector<int> topology;
+      std::vector<Activation> activations;
+      std::vector<std::vector<double>> params;
+    };
+
+    SnapshotPolicy onFull;
+    std::vector<Buffer> slots;
+    // Buffers free to fill, and filled ones in the order submitted.
+    std::vector<int> idle;
+    std::deque<int> queue;
+    // Whether the writer is busy with a buffer taken off the queue.
+    bool writing = false;
+    bool stopping = false;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    long long writtenCount = 0;
+    long long droppedCount = 0;
+    long long failedCount = 0;
+    std::string error;
+
+    std::thread thread;
+
+    // Writes queued buffers until stopped.
+    void run();
+  };
+}
+
+#endif
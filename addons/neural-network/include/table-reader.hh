@@ -0,0 +1,75 @@
+#ifndef TABLE_READER_HH
+#define TABLE_READER_HH
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Reads a table of numbers from text: a row per line, with the values of
+// a row separated by any of a set of delimiters (and by whitespace, so
+// that \r line endings and padding are ignored). Blank lines are skipped.
+//
+// Small files are read in fixed-size chunks and parsed in a single pass
+// as they arrive. Larger ones are mapped into memory and cut at line
+// breaks into a range per thread: each thread counts the rows of its
+// range, a prefix sum over the counts gives the first row of each, and
+// the threads then parse their ranges straight into place.
+class TableReader
+{
+public:
+	// Size of the chunks read from the file in bytes. A longer line grows
+	// the buffer to fit.
+	static const size_t BUFFER_SIZE = 1 << 16;
+	// Files at least this large are parsed by several threads.
+	static const size_t PARALLEL_MIN_BYTES = 1 << 22;
+
+	// Threads of zero uses one per core.
+	explicit TableReader(const std::vector<char>& delims, int threads = 0);
+
+	// Reads the file at path into values, row after row, and sets rows
+	// and cols. Returns false and sets error if the file cannot be read, a
+	// value is not a number or a row does not have as many values as the
+	// first (naming the first such line); values and rows are then left
+	// incomplete.
+	bool read(const std::string& path, std::vector<double>& values, int& rows, int& cols, std::string& error);
+	// Reads the values on [begin, end), line number line of the text,
+	// storing up to capacity of them at values. Returns how many there
+	// were (even past capacity), or -1 after setting error (naming the
+	// line and column) if one is not a number.
+	int parseLine(const char* begin, const char* end, long long line, double* values, int capacity, std::string& error) const;
+	// Same, adding the values to the end of values.
+	int parseLine(const char* begin, const char* end, long long line, std::vector<double>& values, std::string& error) const;
+private:
+	// Whether each character separates values.
+	bool separator[256];
+	int threads;
+
+	// Part of the text given to one thread.
+	struct Range
+	{
+		const char* begin;
+		const char* end;
+		// Line number of the first line, and the number of lines.
+		long long line;
+		long long lines;
+		// Index of the first row, and the number of rows.
+		long long row;
+		long long rows;
+		std::string error;
+	};
+
+	// Reads the file in chunks on the calling thread.
+	bool readStream(FILE* file, std::vector<double>& values, int& rows, int& cols, std::string& error);
+	// Parses length bytes at data with a range per thread.
+	bool readParallel(const char* data, size_t length, std::vector<double>& values, int& rows, int& cols, std::string& error);
+	// Returns whether [begin, end) holds anything but separators.
+	bool blank(const char* begin, const char* end) const;
+	// Counts the lines and non-blank rows of a range.
+	void countRows(Range& range) const;
+	// Parses a range's rows into values, cols per row. Returns false and
+	// sets the range's error at the first bad line.
+	bool parse(Range& range, double* values, int cols) const;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef TEXT_WRITER_HH
+#define TEXT_WRITER_HH
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Writes text through a fixed-size buffer that is handed to a file
+// descriptor (or added to a string) each time it fills, so that large
+// outputs are never held in memory whole. Numbers are formatted straight
+// into the buffer with tools::format.
+class TextWriter
+{
+public:
+	// Size of the buffer in bytes.
+	static const size_t BUFFER_SIZE = 1 << 16;
+
+	// Writes to a string, returned by str().
+	TextWriter();
+	// Writes to the file at path, replacing anything in it unless append
+	// is set. Binary output has its line endings left alone on Windows.
+	explicit TextWriter(const std::string& path, bool append = false, bool binary = false);
+	// Flushes and closes the file.
+	~TextWriter();
+
+	// Returns false if the file could not be opened or written.
+	bool good();
+
+	void write(const char* text, size_t length);
+	void write(const std::string& text);
+	void write(char c);
+	void writeInt(long long value);
+	// Writes value to precision decimal places (or tools::SHORTEST),
+	// padded on the left with spaces to at least padding characters.
+	void writeNumber(double value, int precision, int padding = 0);
+	// Writes count values separated by spaces, wrapped in "[ " and " ]"
+	// when verbose. This is the row format of Matrix::toString.
+	void writeRow(const double* values, size_t count, int precision, bool verbose = false, int padding = 0);
+
+	// Hands the buffer to the file or the string.
+	void flush();
+	// Returns everything written to a string writer.
+	const std::string& str();
+private:
+	// File descriptor, or -1 when writing to output.
+	int fd = -1;
+	bool failed = false;
+	std::string output;
+	std::vector<char> buffer;
+	size_t used = 0;
+
+	// Writes length bytes to the file or the string.
+	void send(const char* data, size_t length);
+};
+
+#endif
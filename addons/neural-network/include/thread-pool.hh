@@ -0,0 +1,77 @@
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A reusable spinning barrier for a fixed number of threads.
+class Barrier
+{
+public:
+	explicit Barrier(int count = 1);
+
+	// Sets the number of threads that must arrive before any may leave.
+	void reset(int count);
+	// Blocks until every thread has arrived.
+	void wait();
+private:
+	int count;
+	std::atomic<int> waiting;
+	std::atomic<int> generation;
+};
+
+// A persistent pool of threads that all run the same task in lock-step.
+// The calling thread takes part as worker 0, so a pool of size n owns
+// n - 1 threads.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+
+	// Returns the number of workers (including the calling thread).
+	int size();
+	// Returns the barrier shared by the workers of the current task.
+	Barrier& barrier();
+	// Runs task(worker) on every worker and returns once all are done.
+	// The task is taken by reference so that no allocation takes place.
+	template <typename F>
+	void run(F& task);
+private:
+	int count;
+	Barrier phase;
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<int> generation;
+	std::atomic<int> remaining;
+	bool stopping = false;
+
+	// Type-erased pointer to the current task.
+	void (*invoke)(void* task, int worker) = nullptr;
+	void* task = nullptr;
+
+	template <typename F>
+	static void call(void* task, int worker);
+
+	void dispatch(void (*invoke)(void*, int), void* task);
+	void loop(int worker);
+};
+
+template <typename F>
+void ThreadPool::run(F& task)
+{
+	dispatch(&ThreadPool::call<F>, &task);
+}
+
+template <typename F>
+void ThreadPool::call(void* task, int worker)
+{
+	(*static_cast<F*>(task))(worker);
+}
+
+#endif
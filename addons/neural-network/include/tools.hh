@@ -1,14 +1,23 @@
 #ifndef TOOLS_HH
 #define TOOLS_HH
 
+#include <stddef.h>
 #include <string>
 #include <vector>
 
 namespace tools
 {
+	// Precision asking for the shortest text that reads back as the same
+	// value, in place of a fixed number of decimal places.
+	const int SHORTEST = -1;
+
 	// Converts the specified value to a string to the specified number of
-	// decimal places (precision).
+	// decimal places (precision), or to SHORTEST.
 	std::string toString(double value, int precision = 4);
+	// Formats value as toString does into the size bytes at output,
+	// returning the length of the text. Like snprintf, a length of size
+	// or more means the text did not fit.
+	int format(double value, int precision, char* output, size_t size);
 	// Removes leading and trailing whitespace from the supplied string.
 	std::string trim(const std::string& s);
 	// Removes leading and trailing whitespace from the supplied string.
@@ -22,6 +31,19 @@ namespace tools
 		const std::string& s,
 		const std::vector<char>& delims
 	);
+	// Reads the number written in [begin, end), as strtod would, into
+	// value. Returns false unless the whole of the text is a number.
+	bool parseNumber(const char* begin, const char* end, double& value);
+	// Writes length bytes to the file at path, replacing it in one step:
+	// the bytes are written beside it, flushed to disk and renamed over
+	// it, so readers see either the old or the new file. Returns false
+	// and sets error on failure.
+	bool writeFile(
+		const std::string& path,
+		const void* data,
+		size_t length,
+		std::string& error
+	);
 }
 
 #endif
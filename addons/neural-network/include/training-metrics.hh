@@ -0,0 +1,51 @@
+#ifndef TRAINING_METRICS_HH
+#define TRAINING_METRICS_HH
+
+#include <stddef.h>
+
+namespace ANN
+{
+  // A ring of per-epoch metrics laid out over a buffer of doubles that
+  // JavaScript reads through a Float64Array while training runs.
+  //
+  // The buffer starts with HEADER values:
+  //   [0] capacity  records the ring holds
+  //   [1] fields    values per record (FIELDS)
+  //   [2] runs      training runs started
+  //   [3] running   1 while a run is in progress
+  //   [4] count     records written by the current run
+  // and then capacity records of FIELDS values: a sequence number, the
+  // epoch, the training and testing MSE, the training and testing
+  // accuracy (in percent) and the training samples per second.
+  //
+  // Record n of a run goes to slot n % capacity. Its sequence number is
+  // odd (2n + 1) while it is being written and 2n + 2 once it is done,
+  // after which count becomes n + 1. A reader copies the record and
+  // keeps it if the sequence number was 2n + 2 both before and after.
+  class TrainingMetrics
+  {
+  public:
+    static const int HEADER = 8;
+    static const int FIELDS = 7;
+
+    // Returns the number of doubles needed for a ring of capacity
+    // records.
+    static size_t size(int capacity);
+
+    // Lays the ring out over data (size(capacity) zeroed doubles, which
+    // must outlive it).
+    TrainingMetrics(double* data, int capacity);
+
+    // Marks the start and end of a run.
+    void start();
+    void stop();
+    // Appends a record. Called from one thread at a time.
+    void push(int epoch, double trainMSE, double testMSE, double trainAccuracy, double testAccuracy, double samplesPerSecond);
+  private:
+    volatile double* data;
+    int capacity;
+    long long count = 0;
+  };
+}
+
+#endif
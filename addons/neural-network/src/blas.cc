@@ -0,0 +1,226 @@
+#include "blas.hh"
+#include <atomic>
+#include <string>
+
+#ifdef ANN_CBLAS
+#include <cblas.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace blas
+{
+  // :: BUILT-IN KERNELS :: //
+  // Sums are accumulated in index order starting from zero, so results
+  // match the hand-written loops they replaced.
+
+  static void builtinGemm(const Backend& self, bool transA, bool transB, int m, int n, int k, double alpha,
+    const double* a, int lda, const double* b, int ldb, double beta, double* c, int ldc)
+  {
+    for (int i = 0; i < m; i++)
+    {
+      double* row = c + i * ldc;
+      if (beta == 0.0) for (int j = 0; j < n; j++) row[j] = 0.0;
+      else if (beta != 1.0) for (int j = 0; j < n; j++) row[j] *= beta;
+    }
+    // Add each column of op(A) times each row of op(B), so the inner loop
+    // runs over a contiguous row of C.
+    for (int i = 0; i < m; i++)
+    {
+      double* row = c + i * ldc;
+      for (int p = 0; p < k; p++)
+      {
+        double aip = alpha * (transA ? a[p * lda + i] : a[i * lda + p]);
+        if (transB)
+        {
+          for (int j = 0; j < n; j++) row[j] += aip * b[j * ldb + p];
+        }
+        else
+        {
+          const double* brow = b + p * ldb;
+          for (int j = 0; j < n; j++) row[j] += aip * brow[j];
+        }
+      }
+    }
+  }
+
+  static double builtinDot(const Backend& self, int n, const double* x, const double* y)
+  {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += x[i] * y[i];
+    return sum;
+  }
+
+  static void builtinGemv(const Backend& self, bool trans, int m, int n, double alpha, const double* a, int lda,
+    const double* x, double beta, double* y)
+  {
+    if (!trans)
+    {
+      // One dot product per row of A.
+      for (int i = 0; i < m; i++)
+      {
+        double sum = alpha * builtinDot(self, n, a + i * lda, x);
+        y[i] = beta == 0.0 ? sum : sum + beta * y[i];
+      }
+      return;
+    }
+
+    // A is m x n and y has n entries; walk A by rows.
+    if (beta == 0.0) for (int j = 0; j < n; j++) y[j] = 0.0;
+    else if (beta != 1.0) for (int j = 0; j < n; j++) y[j] *= beta;
+    for (int i = 0; i < m; i++)
+    {
+      const double* row = a + i * lda;
+      double xi = alpha * x[i];
+      for (int j = 0; j < n; j++) y[j] += xi * row[j];
+    }
+  }
+
+  static void builtinAxpy(const Backend& self, int n, double alpha, const double* x, double* y)
+  {
+    for (int i = 0; i < n; i++) y[i] += alpha * x[i];
+  }
+
+  static const Backend builtin = {
+    "builtin", builtinGemm, builtinGemv, builtinAxpy, builtinDot, nullptr
+  };
+
+  // :: LINKED CBLAS :: //
+#ifdef ANN_CBLAS
+#ifndef ANN_CBLAS_NAME
+#define ANN_CBLAS_NAME "cblas"
+#endif
+  static void linkedGemm(const Backend& self, bool transA, bool transB, int m, int n, int k, double alpha,
+    const double* a, int lda, const double* b, int ldb, double beta, double* c, int ldc)
+  {
+    cblas_dgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans, transB ? CblasTrans : CblasNoTrans,
+      m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+
+  static void linkedGemv(const Backend& self, bool trans, int m, int n, double alpha, const double* a, int lda,
+    const double* x, double beta, double* y)
+  {
+    cblas_dgemv(CblasRowMajor, trans ? CblasTrans : CblasNoTrans, m, n, alpha, a, lda, x, 1, beta, y, 1);
+  }
+
+  static void linkedAxpy(const Backend& self, int n, double alpha, const double* x, double* y)
+  {
+    cblas_daxpy(n, alpha, x, 1, y, 1);
+  }
+
+  static double linkedDot(const Backend& self, int n, const double* x, const double* y)
+  {
+    return cblas_ddot(n, x, 1, y, 1);
+  }
+
+  static const Backend linked = {
+    ANN_CBLAS_NAME, linkedGemm, linkedGemv, linkedAxpy, linkedDot, nullptr
+  };
+  static const Backend* defaultBackend = &linked;
+#else
+  static const Backend* defaultBackend = &builtin;
+#endif
+
+  // :: RUNTIME LOADED CBLAS :: //
+  // CBLAS enumeration values, fixed by the reference interface.
+  static const int ROW_MAJOR = 101;
+  static const int NO_TRANS = 111;
+  static const int TRANS = 112;
+
+  typedef void (*DgemmFn)(int, int, int, int, int, int, double, const double*, int,
+    const double*, int, double, double*, int);
+  typedef void (*DgemvFn)(int, int, int, int, double, const double*, int, const double*, int,
+    double, double*, int);
+  typedef void (*DaxpyFn)(int, double, const double*, int, double*, int);
+  typedef double (*DdotFn)(int, const double*, int, const double*, int);
+
+  struct Library
+  {
+    DgemmFn dgemm;
+    DgemvFn dgemv;
+    DaxpyFn daxpy;
+    DdotFn ddot;
+  };
+
+  static void loadedGemm(const Backend& self, bool transA, bool transB, int m, int n, int k, double alpha,
+    const double* a, int lda, const double* b, int ldb, double beta, double* c, int ldc)
+  {
+    self.library->dgemm(ROW_MAJOR, transA ? TRANS : NO_TRANS, transB ? TRANS : NO_TRANS,
+      m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+
+  static void loadedGemv(const Backend& self, bool trans, int m, int n, double alpha, const double* a, int lda,
+    const double* x, double beta, double* y)
+  {
+    self.library->dgemv(ROW_MAJOR, trans ? TRANS : NO_TRANS, m, n, alpha, a, lda, x, 1, beta, y, 1);
+  }
+
+  static void loadedAxpy(const Backend& self, int n, double alpha, const double* x, double* y)
+  {
+    self.library->daxpy(n, alpha, x, 1, y, 1);
+  }
+
+  static double loadedDot(const Backend& self, int n, const double* x, const double* y)
+  {
+    return self.library->ddot(n, x, 1, y, 1);
+  }
+
+  // Published with release and read with acquire, so a thread that sees
+  // a new backend also sees its contents.
+  static std::atomic<const Backend*> current(defaultBackend);
+
+  const Backend& active()
+  {
+    return *current.load(std::memory_order_acquire);
+  }
+
+  bool load(const std::string& path)
+  {
+#ifdef _WIN32
+    HMODULE library = LoadLibraryA(path.c_str());
+    if (!library) return false;
+    DgemmFn dgemm = (DgemmFn)GetProcAddress(library, "cblas_dgemm");
+    DgemvFn dgemv = (DgemvFn)GetProcAddress(library, "cblas_dgemv");
+    DaxpyFn daxpy = (DaxpyFn)GetProcAddress(library, "cblas_daxpy");
+    DdotFn ddot = (DdotFn)GetProcAddress(library, "cblas_ddot");
+#else
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library) return false;
+    DgemmFn dgemm = (DgemmFn)dlsym(library, "cblas_dgemm");
+    DgemvFn dgemv = (DgemvFn)dlsym(library, "cblas_dgemv");
+    DaxpyFn daxpy = (DaxpyFn)dlsym(library, "cblas_daxpy");
+    DdotFn ddot = (DdotFn)dlsym(library, "cblas_ddot");
+#endif
+    if (!dgemm || !dgemv || !daxpy || !ddot)
+    {
+#ifdef _WIN32
+      FreeLibrary(library);
+#else
+      dlclose(library);
+#endif
+      return false;
+    }
+
+    // The library and the backend stay for the lifetime of the process,
+    // since other threads may still be calling into an earlier one.
+    Library* entries = new Library();
+    entries->dgemm = dgemm;
+    entries->dgemv = dgemv;
+    entries->daxpy = daxpy;
+    entries->ddot = ddot;
+    Backend* backend = new Backend{
+      "dlopen:" + path, loadedGemm, loadedGemv, loadedAxpy, loadedDot, entries
+    };
+    current.store(backend, std::memory_order_release);
+    return true;
+  }
+
+  void reset()
+  {
+    current.store(defaultBackend, std::memory_order_release);
+  }
+}
@@ -0,0 +1,185 @@
+#include "checkpoint.hh"
+#include "tools.hh"
+#include <fstream>
+#include <iterator>
+#include <stdint.h>
+#include <string.h>
+
+namespace ANN
+{
+  static const char MAGIC[8] = { 'A', 'N', 'N', 'C', 'H', 'K', 'P', 'T' };
+
+  // FNV-1a of length bytes.
+  static uint64_t Checksum(const char* data, size_t length)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+      hash ^= (uint8_t)data[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // Appends fields to a byte string.
+  class Writer
+  {
+  public:
+    std::string bytes;
+
+    template <typename T>
+    void value(T v)
+    {
+      bytes.append((const char*)&v, sizeof(T));
+    }
+
+    template <typename T>
+    void vector(const std::vector<T>& v)
+    {
+      value<uint64_t>(v.size());
+      if (!v.empty()) bytes.append((const char*)v.data(), v.size() * sizeof(T));
+    }
+  };
+
+  // Takes fields from a byte string, failing once it runs out.
+  class Reader
+  {
+  public:
+    Reader(const std::string& bytes, size_t length) : bytes(bytes), length(length) {}
+
+    bool ok = true;
+
+    template <typename T>
+    T value()
+    {
+      T v = T();
+      if (!take(&v, sizeof(T))) ok = false;
+      return v;
+    }
+
+    template <typename T>
+    std::vector<T> vector()
+    {
+      uint64_t count = value<uint64_t>();
+      if (!ok || count > (length - offset) / sizeof(T))
+      {
+        ok = false;
+        return std::vector<T>();
+      }
+      std::vector<T> v((size_t)count);
+      if (count > 0) take(v.data(), (size_t)count * sizeof(T));
+      return v;
+    }
+
+    bool done()
+    {
+      return ok && offset == length;
+    }
+  private:
+    const std::string& bytes;
+    size_t length;
+    size_t offset = 0;
+
+    bool take(void* out, size_t count)
+    {
+      if (count > length - offset) return false;
+      memcpy(out, bytes.data() + offset, count);
+      offset += count;
+      return true;
+    }
+  };
+
+  std::string Checkpoint::bytes() const
+  {
+    Writer out;
+    out.bytes.append(MAGIC, sizeof(MAGIC));
+    out.value<uint32_t>(VERSION);
+    out.vector(topology);
+    for (size_t l = 0; l + 1 < topology.size(); l++)
+    {
+      out.vector(params[l]);
+      out.vector(prevDelta[l]);
+    }
+    out.value(momentum);
+    out.value(weightDecay);
+    out.value<int32_t>(epoch);
+    out.vector(trainingAccuracy);
+    out.vector(testingAccuracy);
+    out.vector(order);
+    out.vector(std::vector<char>(random.begin(), random.end()));
+    out.vector(losses);
+    out.value(Checksum(out.bytes.data(), out.bytes.size()));
+    return out.bytes;
+  }
+
+  bool Checkpoint::write(const std::string& path, std::string& error) const
+  {
+    std::string data = bytes();
+    return tools::writeFile(path, data.data(), data.size(), error);
+  }
+
+  bool Checkpoint::read(const std::string& path, std::string& error)
+  {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+      error = "Cannot open " + path + ".";
+      return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return parse(bytes, path, error);
+  }
+
+  bool Checkpoint::parse(const std::string& bytes, const std::string& path, std::string& error)
+  {
+    if (bytes.size() < sizeof(MAGIC) + sizeof(uint32_t) + sizeof(uint64_t) || memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+      error = path + " is not a checkpoint.";
+      return false;
+    }
+
+    size_t length = bytes.size() - sizeof(uint64_t);
+    uint64_t checksum;
+    memcpy(&checksum, bytes.data() + length, sizeof(checksum));
+    if (Checksum(bytes.data(), length) != checksum)
+    {
+      error = path + ": checksum mismatch.";
+      return false;
+    }
+
+    Reader in(bytes, length);
+    for (size_t i = 0; i < sizeof(MAGIC); i++) in.value<char>();
+    uint32_t version = in.value<uint32_t>();
+    if (version != VERSION)
+    {
+      error = path + ": unsupported checkpoint version " + std::to_string(version) + ".";
+      return false;
+    }
+    topology = in.vector<int>();
+    params.clear();
+    prevDelta.clear();
+    for (size_t l = 0; in.ok && l + 1 < topology.size(); l++)
+    {
+      params.push_back(in.vector<double>());
+      prevDelta.push_back(in.vector<double>());
+    }
+    momentum = in.value<double>();
+    weightDecay = in.value<double>();
+    epoch = in.value<int32_t>();
+    trainingAccuracy = in.vector<double>();
+    testingAccuracy = in.vector<double>();
+    order = in.vector<int>();
+    std::vector<char> state = in.vector<char>();
+    random.assign(state.begin(), state.end());
+    losses = in.vector<double>();
+    // The order indexes the training rows, one entry per row.
+    bool valid = in.done() && epoch >= 0;
+    for (int row : order) valid = valid && row >= 0 && row < (int)order.size();
+    if (!valid)
+    {
+      error = path + " is damaged.";
+      return false;
+    }
+    return true;
+  }
+}
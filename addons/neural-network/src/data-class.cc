@@ -1,5 +1,7 @@
 #include "data-class.hh"
+#include "table-reader.hh"
 #include "tools.hh"
+#include <algorithm>
 #include <fstream>
 #include <math.h>
 
@@ -118,7 +120,12 @@ namespace ANN
         else if (args[0]->IsString())
         {
           std::string path(*String::Utf8Value(args[0]));
-          cls = new DataClass(path);
+          cls = new DataClass();
+          if (!cls->_ReadFromFile(path, isolate))
+          {
+            delete cls;
+            return;
+          }
         }
         else
         {
@@ -639,119 +646,57 @@ namespace ANN
     }
 
     std::string path(*String::Utf8Value(args[0]));
+    int precision = 2;
+    if (args[1]->IsNumber()) precision = std::max(0, (int)args[1]->NumberValue());
+    else if (args[1]->IsString() && std::string(*String::Utf8Value(args[1])) == "shortest") precision = tools::SHORTEST;
 
     // Open file for writing and truncate the file if it already exists.
-		std::ofstream file(path, std::ios::out | std::ios::trunc);
+    // Rows are formatted into the writer's buffer and written out as it
+    // fills.
+		TextWriter file(path);
+		cls->data.write(file, precision);
+		file.flush();
 
-		// Generate output string.
-		std::string output = "";
-		for (int i = 0; i < cls->data.rows(); i++)
+		if (!file.good())
 		{
-			for (int j = 0; j < cls->data.cols(); j++)
-			{
-				if (j > 0) output += " ";
-				output += tools::toString(cls->data[i][j], 2);
-			}
-			output += "\n";
+			isolate->ThrowException(Exception::Error(
+				String::NewFromUtf8(isolate, ("Cannot write " + path + ".").c_str())
+			));
 		}
-
-		// Write output to file.
-		file.write(output.c_str(), output.length());
-
-		// Close file.
-		file.close();
   }
 
-  void DataClass::_ReadFromFile(const std::string& path, Isolate* isolate)
+  bool DataClass::_ReadFromFile(const std::string& path, Isolate* isolate)
   {
-    // First, count lines.
-		int counter = 0;
-		std::string line;
-
-		// Open file for reading.
-		std::ifstream file(path, std::ios::in);
-		// Check if file exists.
-		if (!file)
-		{
-			// File does not exist.
-      file.close();
-      std::string msg = "File " + path + " does not exist.";
+    // Parse the file into a block of values, row after row (on a thread
+    // per core for large files). The current data is only replaced once
+    // all of it has been read.
+    TableReader reader(delims);
+    std::vector<double> values;
+    int newRows, newCols;
+    std::string error;
+    if (!reader.read(path, values, newRows, newCols, error))
+    {
       if (isolate != NULL)
       {
-        isolate->ThrowException(Exception::TypeError(
-          String::NewFromUtf8(isolate, msg.c_str())
+        isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, error.c_str())
         ));
       }
       else
       {
-        throw "File " + path + " does not exist.";
+        throw error;
       }
-      return;
-		}
-
-		// Count the number of lines.
-		while (std::getline(file, line))
-		{
-			if (tools::trim(line) != "") counter++;
-		}
-
-		// Seek back to start.
-		file.clear();
-		file.seekg(0, std::ios::beg);
-
-		rows = counter;
-		cols = -1;
-		data = Matrix<double>(rows);
-
-		counter = 0;
-		while (std::getline(file, line))
-		{
-			if (tools::trim(line) != "")
-			{
-				std::vector<std::string> split = tools::split(line, delims);
-				int count = 0;
-				for (std::string s : split)
-				{
-					if (tools::trim(s) != "") count++;
-				}
-				if (cols == -1)
-				{
-					cols = count;
-					data.resize_cols(count);
-				}
-				else if (cols != count)
-				{
-					// INCONSISTENT COLUMN COUNT.
-					file.close();
-					return;
-				}
-				count = 0;
-				for (std::string s : split)
-				{
-					if (tools::trim(s) != "")
-					{
-						double d;
-						try
-						{
-							d = std::stod(s);
-						}
-						catch (std::exception e)
-						{
-							// COULD NOT CONVERT STRING TO DOUBLE.
-							file.close();
-							return;
-						}
-						data[counter][count] = d;
-						count++;
-					}
-				}
-
-				counter++;
-			}
-		}
+      return false;
+    }
 
-		// Close file.
-		file.close();
+    rows = newRows;
+    cols = newCols;
+    data = Matrix<double>(rows, cols);
+    for (int i = 0; i < rows; i++)
+    {
+      std::copy(values.begin() + (size_t)i * cols, values.begin() + (size_t)(i + 1) * cols, data[i].begin());
+    }
+    return true;
   }
 
   std::vector<int> DataClass::GenerateSequence(int count)
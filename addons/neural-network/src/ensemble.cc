@@ -0,0 +1,305 @@
+#include "ensemble.hh"
+#include "blas.hh"
+#include "data-class.hh"
+#include <algorithm>
+#include <math.h>
+#include <string>
+#include <thread>
+
+namespace ANN
+{
+  using v8::Array;
+  using v8::ArrayBuffer;
+  using v8::Context;
+  using v8::Exception;
+  using v8::Float64Array;
+  using v8::FunctionTemplate;
+  using v8::Isolate;
+  using v8::String;
+
+  Persistent<Function> Ensemble::constructor;
+
+  void Ensemble::Init(Local<Object> exports)
+  {
+    Isolate* isolate = exports->GetIsolate();
+
+    // Prepare constructor template.
+    Local<FunctionTemplate> tmpl = FunctionTemplate::New(isolate, New);
+    tmpl->SetClassName(String::NewFromUtf8(isolate, "Ensemble"));
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Add methods to prototype.
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "train", Train);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predict", Predict);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "size", Size);
+
+    // Export new item.
+    constructor.Reset(isolate, tmpl->GetFunction());
+    exports->Set(
+      String::NewFromUtf8(isolate, "Ensemble"),
+      tmpl->GetFunction()
+    );
+  }
+
+  void Ensemble::New(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    if (args.IsConstructCall())
+    {
+      if (NeuralNetwork::asyncRuns > 0)
+      {
+        // The members' weights would come from the generator in use.
+        isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Another network is training.")
+        ));
+        return;
+      }
+      // Ensemble invoked as constructor.
+      // Get arguments: int members, array of layer sizes (input first).
+      if (!args[0]->IsNumber() || !args[1]->IsArray())
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Expected a member count and an array of layer sizes.")
+        ));
+        return;
+      }
+      int count = (int)args[0]->NumberValue();
+      std::vector<int> num;
+      Array* sizes = Array::Cast(*args[1]);
+      for (int i = 0; i < (int)sizes->Length(); i++)
+      {
+        Local<Value> size = sizes->Get(i);
+        num.push_back(size->IsNumber() ? (int)size->NumberValue() : 0);
+      }
+      if (count < 1 || num.size() < 2 || *std::min_element(num.begin(), num.end()) < 1)
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Need at least one member and two positive layer sizes.")
+        ));
+        return;
+      }
+
+      Ensemble* ensemble = new Ensemble(count, num);
+      ensemble->Wrap(args.This());
+      args.GetReturnValue().Set(args.This());
+    }
+    else
+    {
+      // Ensemble invoked as plain function.
+      const int argc = 2;
+      Local<Value> argv[argc] = { args[0], args[1] };
+      Local<Context> context = isolate->GetCurrentContext();
+      Local<Function> construct = Local<Function>::New(isolate, constructor);
+      Local<Object> result = construct->NewInstance(context, argc, argv).ToLocalChecked();
+      args.GetReturnValue().Set(result);
+    }
+  }
+
+  Ensemble::Ensemble(int count, const std::vector<int>& topology)
+  {
+    this->topology = topology;
+    for (int m = 0; m < count; m++)
+    {
+      // Members run single-threaded; the ensemble spreads them out.
+      this->members.push_back(std::unique_ptr<NeuralNetwork>(new NeuralNetwork(topology)));
+      this->members.back()->SetThreads(1);
+    }
+
+    int threads = std::min(count, (int)std::thread::hardware_concurrency());
+    if (threads > 1) this->pool.reset(new ThreadPool(threads));
+
+    this->Stack();
+  }
+
+  void Ensemble::Train(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: training data, maximum epochs, learning rate.
+    if (args.Length() < 3 || !args[0]->IsObject() || !args[1]->IsNumber() || !args[2]->IsNumber())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Expected a DataClass, epochs and a learning rate.")
+      ));
+      return;
+    }
+    DataClass* train = ObjectWrap::Unwrap<DataClass>(args[0]->ToObject());
+    int maxEpochs = (int)args[1]->NumberValue();
+    double learnRate = args[2]->NumberValue();
+
+    // Unwrap Ensemble.
+    Ensemble* ensemble = ObjectWrap::Unwrap<Ensemble>(args.Holder());
+    if (train->data.rows() < 1 || train->data.cols() != ensemble->topology.front() + ensemble->topology.back())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Training data must hold inputs and targets.")
+      ));
+      return;
+    }
+
+    // Every member gets its own generator, so they can train at once.
+    int count = (int)ensemble->members.size();
+    std::vector<Random> randoms(count);
+    int workers = ensemble->pool ? ensemble->pool->size() : 1;
+    auto task = [&](int worker)
+    {
+      for (int m = worker; m < count; m += workers)
+      {
+        ensemble->TrainMember(m, train->data, maxEpochs, learnRate, randoms[m]);
+      }
+    };
+    if (ensemble->pool) ensemble->pool->run(task);
+    else task(0);
+
+    ensemble->Stack();
+  }
+
+  void Ensemble::TrainMember(int m, Matrix<double>& data, int epochs, double learnRate, Random& random)
+  {
+    NeuralNetwork* nn = members[m].get();
+    int rows = data.rows();
+
+    // Bootstrap resample: row indices drawn with replacement.
+    std::vector<int> sample = std::vector<int>(rows);
+    for (int i = 0; i < rows; i++)
+    {
+      sample[i] = std::min(rows - 1, (int)(random.nextDouble() * rows));
+    }
+
+    std::vector<double> xValues = std::vector<double>(nn->numInput);
+    std::vector<double> tValues = std::vector<double>(nn->numOutput);
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+      // Visit the resample in a random order.
+      for (int i = rows - 1; i > 0; i--)
+      {
+        std::swap(sample[i], sample[std::min(i, (int)(random.nextDouble() * (i + 1)))]);
+      }
+      for (int idx : sample)
+      {
+        xValues.assign(data[idx].begin(), data[idx].begin() + nn->numInput);
+        tValues.assign(data[idx].begin() + nn->numInput, data[idx].end());
+        nn->ComputeOutputs(xValues);
+        nn->UpdateWeights(tValues, learnRate);
+      }
+    }
+  }
+
+  void Ensemble::Stack()
+  {
+    int count = (int)members.size();
+    int inputs = topology[0];
+    int width = topology[1];
+    int stride = count * width;
+    stackedWeights = std::vector<double>((size_t)inputs * stride);
+    stackedBiases = std::vector<double>(stride);
+    for (int m = 0; m < count; m++)
+    {
+      Layer& layer = members[m]->layers[0];
+      for (int i = 0; i < inputs; i++)
+      {
+        std::copy(layer.weights() + i * width, layer.weights() + (i + 1) * width, stackedWeights.begin() + (size_t)i * stride + m * width);
+      }
+      std::copy(layer.biases(), layer.biases() + width, stackedBiases.begin() + m * width);
+    }
+  }
+
+  void Ensemble::Predict(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap Ensemble.
+    Ensemble* ensemble = ObjectWrap::Unwrap<Ensemble>(args.Holder());
+
+    // Get arguments: rows to predict, and optionally 'vote'.
+    bool vote = args.Length() > 1 && args[1]->IsString()
+      && std::string(*String::Utf8Value(args[1])) == "vote";
+
+    NeuralNetwork::PredictInput input;
+    std::vector<double> copy;
+    if (!NeuralNetwork::ReadPredictInput(isolate, args[0], ensemble->topology.front(), input, copy)) return;
+
+    size_t count = (size_t)input.rows * ensemble->topology.back();
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, count * sizeof(double));
+    ensemble->PredictBatch(input, (double*)buffer->GetContents().Data(), vote);
+    args.GetReturnValue().Set(Float64Array::New(buffer, 0, count));
+  }
+
+  void Ensemble::Size(const FunctionCallbackInfo<Value>& args)
+  {
+    // Unwrap Ensemble.
+    Ensemble* ensemble = ObjectWrap::Unwrap<Ensemble>(args.Holder());
+    args.GetReturnValue().Set((int)ensemble->members.size());
+  }
+
+  void Ensemble::PredictBatch(const NeuralNetwork::PredictInput& input, double* probs, bool vote)
+  {
+    const int BLOCK = NeuralNetwork::PREDICT_BLOCK;
+    int count = (int)members.size();
+    int numInput = topology.front();
+    int numOutput = topology.back();
+    int width = topology[1];
+    int stride = count * width;
+    int widest = *std::max_element(topology.begin(), topology.end());
+    Activation activation = members[0]->layers[0].activation;
+    int blocks = (input.rows + BLOCK - 1) / BLOCK;
+    int workers = pool && blocks > 1 ? pool->size() : 1;
+
+    auto task = [&](int worker)
+    {
+      std::vector<double> x((size_t)BLOCK * numInput);
+      std::vector<double> stacked((size_t)BLOCK * stride);
+      std::vector<double> a((size_t)BLOCK * widest);
+      std::vector<double> b((size_t)BLOCK * widest);
+      std::vector<double> p(numOutput);
+      for (int block = worker; block < blocks; block += workers)
+      {
+        int first = block * BLOCK;
+        int rows = std::min(BLOCK, input.rows - first);
+        for (int r = 0; r < rows; r++)
+        {
+          NeuralNetwork::CopyRow(input, first + r, numInput, x.data() + r * numInput);
+        }
+
+        // First layer of every member in one product.
+        blas::gemm(false, false, rows, stride, numInput, 1.0, x.data(), numInput, stackedWeights.data(), stride, 0.0, stacked.data(), stride);
+        for (int r = 0; r < rows; r++)
+        {
+          double* row = stacked.data() + (size_t)r * stride;
+          for (int j = 0; j < stride; j++) row[j] = Layer::activate(activation, row[j] + stackedBiases[j]);
+        }
+
+        double* out = probs + (size_t)first * numOutput;
+        std::fill(out, out + (size_t)rows * numOutput, 0.0);
+        for (int m = 0; m < count; m++)
+        {
+          // The rest of the member's layers on its slice of the block.
+          double* in = a.data();
+          double* next = b.data();
+          for (int r = 0; r < rows; r++)
+          {
+            const double* slice = stacked.data() + (size_t)r * stride + m * width;
+            std::copy(slice, slice + width, in + r * width);
+          }
+          for (int l = 1; l < members[m]->layers.size(); l++)
+          {
+            members[m]->layers[l].forwardBatch(in, rows, next);
+            std::swap(in, next);
+          }
+
+          for (int r = 0; r < rows; r++)
+          {
+            NeuralNetwork::Softmax(in + r * numOutput, numOutput, p.data());
+            double* result = out + r * numOutput;
+            if (vote) result[std::max_element(p.begin(), p.end()) - p.begin()] += 1.0 / count;
+            else for (int k = 0; k < numOutput; k++) result[k] += p[k] / count;
+          }
+        }
+      }
+    };
+
+    if (workers > 1) pool->run(task);
+    else task(0);
+  }
+}
@@ -0,0 +1,198 @@
+#include "epoch-log.hh"
+#include "tools.hh"
+#include <chrono>
+#include <fstream>
+#include <stdint.h>
+
+namespace ANN
+{
+  static const char MAGIC[8] = { 'A', 'N', 'N', 'E', 'P', 'L', 'O', 'G' };
+
+  // Names of the columns, in the order of LogColumn.
+  static const char* const COLUMN_NAMES[] = {
+    "epoch", "trainMSE", "testMSE", "trainAccuracy", "testAccuracy", "visited", "seconds"
+  };
+
+  static double ColumnValue(const EpochRecord& record, LogColumn column)
+  {
+    switch (column)
+    {
+      case LogColumn::Epoch: return record.epoch;
+      case LogColumn::TrainMSE: return record.trainMSE;
+      case LogColumn::TestMSE: return record.testMSE;
+      case LogColumn::TrainAccuracy: return record.trainAccuracy;
+      case LogColumn::TestAccuracy: return record.testAccuracy;
+      case LogColumn::Visited: return record.visited;
+      default: return record.seconds;
+    }
+  }
+
+  EpochLog::EpochLog(const std::string& path, bool append, LogFormat format, const std::vector<LogColumn>& columns, int flushMillis)
+    : format(format), columns(columns), flushMillis(flushMillis), ring(CAPACITY), head(0), tail(0)
+  {
+    // A header is only written at the start of a file.
+    bool fresh = !append;
+    if (append)
+    {
+      std::ifstream existing(path, std::ios::in | std::ios::binary | std::ios::ate);
+      fresh = !existing || existing.tellg() <= 0;
+    }
+    out.reset(new TextWriter(path, append, format == LogFormat::Binary));
+    if (fresh) header();
+    thread = std::thread(&EpochLog::run, this);
+  }
+
+  EpochLog::~EpochLog()
+  {
+    close();
+  }
+
+  bool EpochLog::parseColumn(const std::string& name, LogColumn& column)
+  {
+    for (int i = 0; i < sizeof(COLUMN_NAMES) / sizeof(COLUMN_NAMES[0]); i++)
+    {
+      if (name == COLUMN_NAMES[i])
+      {
+        column = (LogColumn)i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void EpochLog::push(const EpochRecord& record)
+  {
+    size_t at = head.load(std::memory_order_relaxed);
+    // Full: the writer is behind on the disk, so wait for it.
+    while (at - tail.load(std::memory_order_acquire) >= CAPACITY)
+    {
+      wake.notify_one();
+      std::this_thread::yield();
+    }
+    ring[at % CAPACITY] = record;
+    head.store(at + 1, std::memory_order_release);
+    // Otherwise the writer finds the record when its interval is up.
+    if (flushMillis <= 0 || at + 1 - tail.load(std::memory_order_relaxed) == CAPACITY / 2) wake.notify_one();
+  }
+
+  bool EpochLog::close()
+  {
+    if (!closed)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_one();
+      thread.join();
+      closed = true;
+    }
+    return out->good();
+  }
+
+  void EpochLog::header()
+  {
+    if (format == LogFormat::Csv)
+    {
+      for (size_t i = 0; i < columns.size(); i++)
+      {
+        if (i > 0) out->write(',');
+        out->write(COLUMN_NAMES[(int)columns[i]]);
+      }
+      out->write('\n');
+    }
+    else if (format == LogFormat::Binary)
+    {
+      uint32_t fields[2] = { VERSION, (uint32_t)columns.size() };
+      out->write(MAGIC, sizeof(MAGIC));
+      out->write((const char*)fields, sizeof(fields));
+      for (LogColumn column : columns)
+      {
+        uint32_t id = (uint32_t)column;
+        out->write((const char*)&id, sizeof(id));
+      }
+    }
+  }
+
+  void EpochLog::write(const EpochRecord& record)
+  {
+    if (format == LogFormat::Text)
+    {
+      // As std::to_string and tools::toString(value, 2) wrote it.
+      out->writeInt(record.epoch);
+      out->write(' ');
+      out->writeNumber(record.trainMSE, 6);
+      out->write(' ');
+      out->writeNumber(record.testMSE, 6);
+      out->write(' ');
+      out->writeNumber(record.trainAccuracy, 2);
+      out->write("% ", 2);
+      out->writeNumber(record.testAccuracy, 2);
+      out->write('%');
+      if (record.visited >= 0)
+      {
+        out->write(' ');
+        out->writeInt(record.visited);
+      }
+      out->write('\n');
+    }
+    else if (format == LogFormat::Csv)
+    {
+      for (size_t i = 0; i < columns.size(); i++)
+      {
+        if (i > 0) out->write(',');
+        if (columns[i] == LogColumn::Epoch || columns[i] == LogColumn::Visited)
+        {
+          out->writeInt((long long)ColumnValue(record, columns[i]));
+        }
+        else out->writeNumber(ColumnValue(record, columns[i]), tools::SHORTEST);
+      }
+      out->write('\n');
+    }
+    else
+    {
+      for (LogColumn column : columns)
+      {
+        double value = ColumnValue(record, column);
+        out->write((const char*)&value, sizeof(value));
+      }
+    }
+  }
+
+  void EpochLog::run()
+  {
+    std::chrono::milliseconds interval(flushMillis > 0 ? flushMillis : 0);
+    std::chrono::steady_clock::time_point flushed = std::chrono::steady_clock::now();
+    while (true)
+    {
+      bool stop;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = stopping;
+      }
+      // Format everything queued (after a stop, that is everything
+      // there will be).
+      size_t end = head.load(std::memory_order_acquire);
+      for (size_t at = tail.load(std::memory_order_relaxed); at < end; at++) write(ring[at % CAPACITY]);
+      tail.store(end, std::memory_order_release);
+      if (stop) break;
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - flushed >= interval)
+      {
+        out->flush();
+        flushed = now;
+      }
+
+      // Sleep until the interval is up or push() asks for a drain; a
+      // wake-up that comes between the check and the wait only costs the
+      // rest of the interval.
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!stopping && head.load(std::memory_order_acquire) == end)
+      {
+        wake.wait_for(lock, flushMillis > 0 ? interval : std::chrono::milliseconds(100));
+      }
+    }
+    out->flush();
+  }
+}
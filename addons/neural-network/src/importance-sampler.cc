@@ -0,0 +1,70 @@
+#include "importance-sampler.hh"
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+ImportanceSampler::ImportanceSampler(int rows, double fraction, double mix)
+{
+	// Every row starts with the same estimate, so the first epoch is
+	// drawn uniformly.
+	this->losses = std::vector<double>(rows, 1.0);
+	this->cumulative = std::vector<double>(rows);
+	this->seen = std::vector<char>(rows);
+	this->fraction = fraction;
+	this->mix = mix < 0.0 ? 0.0 : (mix > 1.0 ? 1.0 : mix);
+}
+
+int ImportanceSampler::rows()
+{
+	return (int)losses.size();
+}
+
+void ImportanceSampler::draw(Random& random, std::vector<int>& sequence, std::vector<double>& weights)
+{
+	int n = rows();
+	int count = (int)ceil(fraction * n);
+	if (count < 1) count = 1;
+	sequence.resize(count);
+	weights.resize(count);
+
+	// Build cumulative probabilities from the loss estimates, mixed with
+	// a uniform distribution so no row is ever starved.
+	double total = 0.0;
+	for (int i = 0; i < n; i++) total += losses[i];
+	double sum = 0.0;
+	for (int i = 0; i < n; i++)
+	{
+		double p = mix / n;
+		if (total > 0.0) p += (1.0 - mix) * losses[i] / total;
+		else p += (1.0 - mix) / n;
+		sum += p;
+		cumulative[i] = sum;
+	}
+
+	std::fill(seen.begin(), seen.end(), 0);
+	distinct = 0;
+	for (int k = 0; k < count; k++)
+	{
+		double r = random.nextDouble() * sum;
+		int i = (int)(std::upper_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin());
+		if (i >= n) i = n - 1;
+		double p = (cumulative[i] - (i > 0 ? cumulative[i - 1] : 0.0)) / sum;
+		sequence[k] = i;
+		weights[k] = 1.0 / (n * p);
+		if (!seen[i])
+		{
+			seen[i] = 1;
+			distinct++;
+		}
+	}
+}
+
+void ImportanceSampler::update(int row, double loss)
+{
+	losses[row] = loss;
+}
+
+int ImportanceSampler::visited()
+{
+	return distinct;
+}
@@ -0,0 +1,488 @@
+#include "inference-server.hh"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace ANN
+{
+  // Size of the request and response headers.
+  static const size_t REQUEST_HEADER = 3 * sizeof(unsigned int);
+  static const size_t RESPONSE_HEADER = 4 * sizeof(unsigned int);
+
+  InferenceServer::Connection::Connection(int fd)
+  {
+    this->fd = fd;
+  }
+
+  InferenceServer::Connection::~Connection()
+  {
+#ifndef _WIN32
+    close(fd);
+#endif
+  }
+
+  InferenceServer::InferenceServer(std::shared_ptr<ModelHandle> models, const ServerOptions& options)
+  {
+    this->models = models;
+    this->numInput = models->load()->numInput();
+    this->numOutput = models->load()->numOutput();
+    this->options = options;
+    if (this->options.maxBatch < 1) this->options.maxBatch = 1;
+    if (this->options.maxWaitMicros < 0) this->options.maxWaitMicros = 0;
+    if (this->options.workers < 1) this->options.workers = 1;
+    this->totals.latency = std::vector<long long>(LATENCY_BUCKETS);
+  }
+
+  InferenceServer::~InferenceServer()
+  {
+    stop();
+  }
+
+  int InferenceServer::port()
+  {
+    return boundPort;
+  }
+
+  ServerStats InferenceServer::stats()
+  {
+    ServerStats result;
+    {
+      std::lock_guard<std::mutex> lock(statsMutex);
+      result = totals;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    result.queueDepth = queuedRows;
+    return result;
+  }
+
+#ifdef _WIN32
+  bool InferenceServer::start(std::string& error)
+  {
+    error = "The inference server is not supported on Windows.";
+    return false;
+  }
+
+  void InferenceServer::stop()
+  {
+  }
+#else
+  bool InferenceServer::start(std::string& error)
+  {
+    if (running) return true;
+
+    if (!options.socketPath.empty())
+    {
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if (options.socketPath.size() >= sizeof(address.sun_path))
+      {
+        error = "Socket path is too long.";
+        return false;
+      }
+      strcpy(address.sun_path, options.socketPath.c_str());
+      // A stale socket file from an earlier run would make bind fail, but
+      // anything else at that path is left alone.
+      struct stat status;
+      if (lstat(options.socketPath.c_str(), &status) == 0)
+      {
+        if (!S_ISSOCK(status.st_mode))
+        {
+          error = "Socket path exists and is not a socket.";
+          return false;
+        }
+        unlink(options.socketPath.c_str());
+      }
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0)
+      {
+        error = std::string("Could not bind socket: ") + strerror(errno);
+        if (listener >= 0) close(listener);
+        listener = -1;
+        return false;
+      }
+    }
+    else
+    {
+      sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons((unsigned short)options.port);
+      listener = socket(AF_INET, SOCK_STREAM, 0);
+      int on = 1;
+      if (listener >= 0) setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0)
+      {
+        error = std::string("Could not bind port: ") + strerror(errno);
+        if (listener >= 0) close(listener);
+        listener = -1;
+        return false;
+      }
+      socklen_t length = sizeof(address);
+      getsockname(listener, (sockaddr*)&address, &length);
+      boundPort = ntohs(address.sin_port);
+    }
+
+    if (listen(listener, 64) < 0 || pipe(wakePipe) < 0)
+    {
+      error = std::string("Could not listen: ") + strerror(errno);
+      close(listener);
+      listener = -1;
+      return false;
+    }
+    for (int fd : wakePipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    stopping = false;
+    running = true;
+    io = std::thread(&InferenceServer::ioLoop, this);
+    for (int i = 0; i < options.workers; i++)
+    {
+      workers.push_back(std::thread(&InferenceServer::workerLoop, this));
+    }
+    return true;
+  }
+
+  void InferenceServer::stop()
+  {
+    if (!running) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      // Nothing more is sent; let the clients know at once.
+      for (auto& connection : connections) shutdown(connection->fd, SHUT_RDWR);
+    }
+    wake.notify_all();
+    notify();
+
+    io.join();
+    for (std::thread& worker : workers) worker.join();
+    workers.clear();
+    queue.clear();
+    queuedRows = 0;
+
+    close(listener);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    listener = wakePipe[0] = wakePipe[1] = -1;
+    if (!options.socketPath.empty()) unlink(options.socketPath.c_str());
+    running = false;
+  }
+
+  void InferenceServer::notify()
+  {
+    // A full pipe already holds a wake-up.
+    char byte = 0;
+    if (write(wakePipe[1], &byte, 1) < 0) {}
+  }
+
+  bool InferenceServer::flush(Connection& connection)
+  {
+    std::lock_guard<std::mutex> lock(connection.mutex);
+    while (connection.written < connection.output.size())
+    {
+      ssize_t count = send(connection.fd, connection.output.data() + connection.written,
+        connection.output.size() - connection.written, MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR) continue;
+      if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+      if (count <= 0) return false;
+      connection.written += (size_t)count;
+    }
+    connection.output.clear();
+    connection.written = 0;
+    return true;
+  }
+
+  void InferenceServer::ioLoop()
+  {
+    std::vector<pollfd> fds;
+    std::vector<char> chunk(1 << 16);
+    std::vector<std::shared_ptr<Connection>> kept;
+
+    while (true)
+    {
+      bool full;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) break;
+        full = queuedRows >= MAX_QUEUED_ROWS;
+      }
+
+      fds.clear();
+      fds.push_back({ wakePipe[0], POLLIN, 0 });
+      fds.push_back({ listener, POLLIN, 0 });
+      for (auto& connection : connections)
+      {
+        // Requests from a client that is not keeping up wait in its
+        // socket rather than in memory.
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        short events = 0;
+        if (!full && !connection->finished && connection->rows < MAX_CONNECTION_ROWS &&
+          connection->output.size() - connection->written < MAX_PENDING_BYTES) events |= POLLIN;
+        if (connection->written < connection->output.size()) events |= POLLOUT;
+        fds.push_back({ connection->fd, events, 0 });
+      }
+
+      if (poll(fds.data(), fds.size(), -1) < 0)
+      {
+        if (errno == EINTR) continue;
+        break;
+      }
+      if (fds[0].revents)
+      {
+        // Stopping is checked at the top of the loop.
+        char bytes[64];
+        while (read(wakePipe[0], bytes, sizeof(bytes)) > 0) {}
+      }
+      // Connections accepted below were not polled this round.
+      int polled = (int)connections.size();
+
+      kept.clear();
+      if (fds[1].revents & POLLIN)
+      {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0)
+        {
+          int on = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+          setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+          kept.push_back(std::make_shared<Connection>(fd));
+        }
+      }
+
+      // Send and read on every ready connection. A connection is dropped
+      // on error, or once the peer has stopped sending and has had all
+      // its responses. The socket is only closed once no queued request
+      // refers to it.
+      for (int i = 0; i < polled; i++)
+      {
+        std::shared_ptr<Connection>& connection = connections[i];
+        bool open = true;
+        short events = fds[i + 2].revents;
+        if (events & POLLOUT) open = flush(*connection);
+        if (open && (fds[i + 2].events & POLLIN) && (events & (POLLIN | POLLHUP | POLLERR)))
+        {
+          ssize_t count = recv(connection->fd, chunk.data(), chunk.size(), 0);
+          if (count == 0) connection->finished = true;
+          else if (count < 0) open = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+          else
+          {
+            connection->buffer.insert(connection->buffer.end(), chunk.begin(), chunk.begin() + count);
+            open = parse(connection);
+          }
+        }
+        else if (events & (POLLHUP | POLLERR)) open = false;
+
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->finished && connection->requests == 0 && connection->written == connection->output.size())
+        {
+          open = false;
+        }
+        if (open) kept.push_back(connection);
+        else
+        {
+          connection->closed = true;
+          shutdown(connection->fd, SHUT_RDWR);
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      connections.swap(kept);
+    }
+
+    // Responses still queued are dropped with their connections.
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& connection : connections)
+    {
+      std::lock_guard<std::mutex> closing(connection->mutex);
+      connection->closed = true;
+    }
+    connections.clear();
+  }
+
+  bool InferenceServer::parse(std::shared_ptr<Connection>& connection)
+  {
+    std::vector<char>& buffer = connection->buffer;
+    size_t offset = 0;
+    // Number of requests queued.
+    int added = 0;
+
+    while (buffer.size() - offset >= REQUEST_HEADER)
+    {
+      unsigned int header[3];
+      memcpy(header, buffer.data() + offset, REQUEST_HEADER);
+      size_t payload = (size_t)header[1] * header[2] * sizeof(float);
+      if (payload > MAX_REQUEST_BYTES) return false;
+      if (buffer.size() - offset < REQUEST_HEADER + payload) break;
+
+      Request request;
+      request.connection = connection;
+      request.id = header[0];
+      request.status = OK;
+      request.rows = (int)header[1];
+      request.arrived = Clock::now();
+      const char* data = buffer.data() + offset + REQUEST_HEADER;
+      offset += REQUEST_HEADER + payload;
+
+      if ((int)header[2] != numInput)
+      {
+        request.status = WRONG_COLUMNS;
+        request.rows = 0;
+      }
+
+      request.inputs = std::vector<double>((size_t)request.rows * numInput);
+      for (size_t i = 0; i < request.inputs.size(); i++)
+      {
+        float value;
+        memcpy(&value, data + i * sizeof(float), sizeof(float));
+        request.inputs[i] = value;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->requests++;
+        connection->rows += request.rows;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      queuedRows += request.rows;
+      added++;
+      queue.push_back(std::move(request));
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + offset);
+
+    // Wake one worker to start a batch, or all of them if a full batch is
+    // already waiting.
+    if (added > 0)
+    {
+      bool full;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        full = queuedRows >= options.maxBatch;
+      }
+      if (full) wake.notify_all();
+      else wake.notify_one();
+    }
+    return true;
+  }
+
+  void InferenceServer::workerLoop()
+  {
+    std::vector<Request> batch;
+    std::vector<double> inputs;
+    std::vector<double> probs;
+
+    while (true)
+    {
+      batch.clear();
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        // Give other requests until the oldest one's deadline to arrive.
+        Clock::time_point deadline = queue.front().arrived + std::chrono::microseconds(options.maxWaitMicros);
+        while (!stopping && !queue.empty() && queuedRows < options.maxBatch && Clock::now() < deadline)
+        {
+          wake.wait_until(lock, deadline);
+        }
+        if (stopping) return;
+        // Another worker may have taken the requests.
+        if (queue.empty()) continue;
+
+        int rows = 0;
+        while (!queue.empty() && (batch.empty() || rows + queue.front().rows <= options.maxBatch))
+        {
+          rows += queue.front().rows;
+          batch.push_back(std::move(queue.front()));
+          queue.pop_front();
+        }
+        queuedRows -= rows;
+      }
+
+      // Run every request of the batch through the model at once.
+      size_t rows = 0;
+      for (Request& request : batch) rows += request.rows;
+      inputs.resize(rows * numInput);
+      probs.resize(rows * numOutput);
+      size_t offset = 0;
+      for (Request& request : batch)
+      {
+        std::copy(request.inputs.begin(), request.inputs.end(), inputs.begin() + offset * numInput);
+        offset += request.rows;
+      }
+      if (rows > 0)
+      {
+        // Hold on to the current snapshot for the whole batch.
+        std::shared_ptr<const Model> model = models->load();
+        model->predict(inputs.data(), (int)rows, probs.data());
+      }
+
+      offset = 0;
+      for (Request& request : batch)
+      {
+        respond(request, request.status, probs.data() + offset * numOutput);
+        offset += request.rows;
+      }
+      // Have the I/O thread send the responses, and read again if it had
+      // paused for the queue.
+      notify();
+      std::lock_guard<std::mutex> lock(statsMutex);
+      totals.batches++;
+    }
+  }
+
+  void InferenceServer::respond(Request& request, Status status, const double* probs)
+  {
+    int rows = status == OK ? request.rows : 0;
+    std::vector<char> message(RESPONSE_HEADER + (size_t)rows * numOutput * sizeof(float));
+    unsigned int header[4] = { request.id, (unsigned int)status, (unsigned int)rows, (unsigned int)numOutput };
+    memcpy(message.data(), header, RESPONSE_HEADER);
+    for (size_t i = 0; i < (size_t)rows * numOutput; i++)
+    {
+      float value = (float)probs[i];
+      memcpy(message.data() + RESPONSE_HEADER + i * sizeof(float), &value, sizeof(float));
+    }
+
+    bool sent;
+    {
+      Connection& connection = *request.connection;
+      std::lock_guard<std::mutex> lock(connection.mutex);
+      sent = !connection.closed;
+      if (sent) connection.output.insert(connection.output.end(), message.begin(), message.end());
+      connection.requests--;
+      connection.rows -= request.rows;
+    }
+
+    // Latency runs until the response is queued for sending.
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - request.arrived).count();
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && micros >= (1LL << bucket)) bucket++;
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    totals.requests++;
+    totals.rows += rows;
+    if (status != OK || !sent) totals.errors++;
+    totals.latency[bucket]++;
+  }
+#endif
+}
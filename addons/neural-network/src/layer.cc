@@ -0,0 +1,280 @@
+#include "layer.hh"
+#include "blas.hh"
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+namespace ANN
+{
+  Layer::Layer(int inputs, int outputs, Activation activation)
+  {
+    this->inputs = inputs;
+    this->outputs = outputs;
+    this->activation = activation;
+
+    this->params = std::vector<double>(inputs * outputs + outputs);
+    this->prevDelta = std::vector<double>(inputs * outputs + outputs);
+    this->values = std::vector<double>(outputs);
+    this->grads = std::vector<double>(outputs);
+  }
+
+  int Layer::size()
+  {
+    return (int)params.size();
+  }
+
+  double* Layer::weights()
+  {
+    return params.data();
+  }
+
+  double* Layer::biases()
+  {
+    return params.data() + inputs * outputs;
+  }
+
+  double Layer::activate(double x)
+  {
+    return activate(activation, x);
+  }
+
+  double Layer::activate(Activation activation, double x)
+  {
+    if (activation == Activation::Linear) return x;
+    if (x < -20.0) return -1.0;
+    else if (x > 20.0) return 1.0;
+    else return tanh(x);
+  }
+
+  void Layer::forward(const double* x, int begin, int end)
+  {
+    const double* w = weights();
+    const double* b = biases();
+    double* y = values.data();
+
+    // Sum of weights * inputs for columns [begin, end) of the weights.
+    blas::gemv(true, inputs, end - begin, 1.0, w + begin, outputs, x, 0.0, y + begin);
+
+    // Add biases and apply activation while the sums are still hot.
+    for (int j = begin; j < end; j++)
+    {
+      y[j] = activate(y[j] + b[j]);
+    }
+  }
+
+  void Layer::forwardBatch(const double* x, int rows, double* y)
+  {
+    forwardBatch(params.data(), inputs, outputs, activation, x, rows, y);
+  }
+
+  void Layer::forwardBatch(const double* params, int inputs, int outputs, Activation activation,
+    const double* x, int rows, double* y)
+  {
+    const double* b = params + inputs * outputs;
+    blas::gemm(false, false, rows, outputs, inputs, 1.0, x, inputs, params, outputs, 0.0, y, outputs);
+    for (int r = 0; r < rows; r++)
+    {
+      double* row = y + r * outputs;
+      for (int j = 0; j < outputs; j++)
+      {
+        row[j] = activate(activation, row[j] + b[j]);
+      }
+    }
+  }
+
+  void Layer::forwardPartial(const double* x, double* partial, int begin, int end, const int* columns, int count)
+  {
+    const double* w = weights();
+    if (!columns && begin == end)
+    {
+      // An empty slice contributes nothing; CBLAS leaves y alone when
+      // m is zero, so clear it here.
+      for (int j = 0; j < outputs; j++) partial[j] = 0.0;
+    }
+    else if (!columns)
+    {
+      // Rows [begin, end) of the weights times the matching inputs.
+      blas::gemv(true, end - begin, outputs, 1.0, w + begin * outputs, outputs, x + begin, 0.0, partial);
+    }
+    else
+    {
+      for (int k = 0; k < count; k++) partial[k] = 0.0;
+      for (int i = begin; i < end; i++)
+      {
+        const double* row = w + i * outputs;
+        double xi = x[i];
+        for (int k = 0; k < count; k++)
+        {
+          partial[k] += xi * row[columns[k]];
+        }
+      }
+    }
+  }
+
+  void Layer::reduce(const double* partials, int workers, int stride, const int* columns, int count)
+  {
+    const double* b = biases();
+    int n = columns ? count : outputs;
+    for (int k = 0; k < n; k++)
+    {
+      double sum = 0.0;
+      for (int w = 0; w < workers; w++)
+      {
+        sum += partials[w * stride + k];
+      }
+      values[k] = activate(sum + b[columns ? columns[k] : k]);
+    }
+  }
+
+  void Layer::backward(const double* prevValues, double* prevGrads, int begin, int end, const int* columns, int count)
+  {
+    const double* w = weights();
+    const double* g = grads.data();
+    if (!columns)
+    {
+      // Weighted sums of grads for rows [begin, end).
+      blas::gemv(false, end - begin, outputs, 1.0, w + begin * outputs, outputs, g, 0.0, prevGrads + begin);
+    }
+    else
+    {
+      for (int i = begin; i < end; i++)
+      {
+        const double* row = w + i * outputs;
+        double sum = 0.0;
+        for (int k = 0; k < count; k++) sum += g[k] * row[columns[k]];
+        prevGrads[i] = sum;
+      }
+    }
+    for (int i = begin; i < end; i++)
+    {
+      // Derivative of tanh = (1 - y) * (1 + y).
+      double derivative = (1 - prevValues[i]) * (1 + prevValues[i]);
+      prevGrads[i] = derivative * prevGrads[i];
+    }
+  }
+
+  void Layer::updateWeights(const double* x, double learnRate, double momentum, double weightDecay, int begin, int end, const int* columns, int count)
+  {
+    double* w = weights();
+    double* d = prevDelta.data();
+    const double* g = grads.data();
+    int n = columns ? count : outputs;
+    for (int i = begin; i < end; i++)
+    {
+      double* row = w + i * outputs;
+      double* prevRow = d + i * outputs;
+      double xi = x[i];
+      for (int k = 0; k < n; k++)
+      {
+        int j = columns ? columns[k] : k;
+        // Compute the new delta. Note: we use '+' instead of '-'. On
+        // the first pass the previous delta is 0.0 but that is okay.
+        double delta = learnRate * g[k] * xi;
+        row[j] += delta;
+        if (momentum > 0) row[j] += momentum * prevRow[j];
+        // Weight decay.
+        if (weightDecay > 0) row[j] -= weightDecay * row[j];
+        // Save the delta for momentum.
+        prevRow[j] = delta;
+      }
+      // Pruned weights stay at zero.
+      if (!mask.empty())
+      {
+        const uint8_t* keep = mask.data() + i * outputs;
+        for (int j = 0; j < outputs; j++)
+        {
+          if (!keep[j]) row[j] = prevRow[j] = 0.0;
+        }
+      }
+    }
+  }
+
+  void Layer::updateBiases(double learnRate, double momentum, double weightDecay, int begin, int end, const int* columns)
+  {
+    double* b = biases();
+    double* d = prevDelta.data() + inputs * outputs;
+    const double* g = grads.data();
+    for (int k = begin; k < end; k++)
+    {
+      int j = columns ? columns[k] : k;
+      double delta = learnRate * g[k] * 1.0;
+      b[j] += delta;
+      if (momentum > 0) b[j] += momentum * d[j];
+      if (weightDecay > 0) b[j] -= weightDecay * b[j];
+      d[j] = delta;
+    }
+  }
+
+  int Layer::prune(double sparsity)
+  {
+    int count = inputs * outputs;
+    int cut = (int)(sparsity * count);
+    if (cut < 0) cut = 0;
+    if (cut > count) cut = count;
+
+    // Order the weights by magnitude, smallest first, up to the cut.
+    double* w = weights();
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++) order[i] = i;
+    std::nth_element(order.begin(), order.begin() + cut, order.end(), [w](int a, int b)
+    {
+      return fabs(w[a]) < fabs(w[b]);
+    });
+
+    mask = std::vector<uint8_t>(count, 1);
+    for (int k = 0; k < cut; k++)
+    {
+      mask[order[k]] = 0;
+      w[order[k]] = 0.0;
+      prevDelta[order[k]] = 0.0;
+    }
+    return count - cut;
+  }
+
+  void Layer::compress()
+  {
+    const double* w = weights();
+    rowStart = std::vector<int>(inputs + 1);
+    columnIndex.clear();
+    sparseWeights.clear();
+    for (int i = 0; i < inputs; i++)
+    {
+      const double* row = w + i * outputs;
+      for (int j = 0; j < outputs; j++)
+      {
+        if (row[j] == 0.0) continue;
+        columnIndex.push_back(j);
+        sparseWeights.push_back(row[j]);
+      }
+      rowStart[i + 1] = (int)columnIndex.size();
+    }
+  }
+
+  void Layer::densify()
+  {
+    mask.clear();
+    rowStart.clear();
+    columnIndex.clear();
+    sparseWeights.clear();
+  }
+
+  void Layer::forwardSparse(const double* x, double* y)
+  {
+    const double* b = biases();
+    for (int j = 0; j < outputs; j++) y[j] = 0.0;
+    // Same order of summation as forward, minus the zero terms.
+    for (int i = 0; i < inputs; i++)
+    {
+      double xi = x[i];
+      if (xi == 0.0) continue;
+      for (int p = rowStart[i]; p < rowStart[i + 1]; p++)
+      {
+        y[columnIndex[p]] += xi * sparseWeights[p];
+      }
+    }
+    for (int j = 0; j < outputs; j++)
+    {
+      y[j] = activate(y[j] + b[j]);
+    }
+  }
+}
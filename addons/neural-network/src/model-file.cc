@@ -0,0 +1,299 @@
+#include "model-file.hh"
+#include "tools.hh"
+#include <algorithm>
+#include <fstream>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ANN
+{
+  static const char MAGIC[8] = { 'A', 'N', 'N', 'M', 'O', 'D', 'E', 'L' };
+  static const uint32_t DTYPE_FLOAT64 = 1;
+  static const size_t HEADER_BYTES = 64;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layers;
+    uint32_t align;
+    uint64_t length;
+    uint64_t checksum;
+    uint8_t reserved[24];
+  };
+
+  // Rounds bytes up to a multiple of the block alignment.
+  static uint64_t Aligned(uint64_t bytes)
+  {
+    return (bytes + ModelFile::ALIGN - 1) / ModelFile::ALIGN * ModelFile::ALIGN;
+  }
+
+  ModelFile::ModelFile()
+  {
+  }
+
+  ModelFile::~ModelFile()
+  {
+#ifndef _WIN32
+    if (mapped) munmap((void*)data, length);
+#endif
+  }
+
+  uint64_t ModelFile::checksum(const uint64_t* words, size_t count)
+  {
+    // FNV-1a taken a word at a time rather than a byte at a time.
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; i++)
+    {
+      hash ^= words[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  bool ModelFile::write(const std::string& path, const std::vector<Layer>& layers, std::string& error)
+  {
+    std::vector<uint64_t> file = image(layers);
+    return tools::writeFile(path, file.data(), file.size() * sizeof(uint64_t), error);
+  }
+
+  std::vector<uint64_t> ModelFile::image(const std::vector<Layer>& layers)
+  {
+    std::vector<int> topology(1, layers.front().inputs);
+    std::vector<Activation> activations;
+    std::vector<const double*> params;
+    for (const Layer& layer : layers)
+    {
+      topology.push_back(layer.outputs);
+      activations.push_back(layer.activation);
+      params.push_back(layer.params.data());
+    }
+    return image(topology, activations, params);
+  }
+
+  bool ModelFile::write(const std::string& path, const std::vector<int>& topology,
+    const std::vector<Activation>& activations, const std::vector<const double*>& params, std::string& error)
+  {
+    std::vector<uint64_t> file = image(topology, activations, params);
+    return tools::writeFile(path, file.data(), file.size() * sizeof(uint64_t), error);
+  }
+
+  std::vector<uint64_t> ModelFile::image(const std::vector<int>& topology,
+    const std::vector<Activation>& activations, const std::vector<const double*>& params)
+  {
+    // Lay the whole file out in memory first; the checksum covers it.
+    size_t count = activations.size();
+    size_t table = HEADER_BYTES + (size_t)Aligned((2 * count + 1) * sizeof(uint32_t));
+    size_t length = table;
+    std::vector<size_t> blocks;
+    for (size_t l = 0; l < count; l++)
+    {
+      blocks.push_back((size_t)(topology[l] + 1) * topology[l + 1] * sizeof(double));
+      length += (size_t)Aligned(blocks.back());
+    }
+    std::vector<uint64_t> file(length / sizeof(uint64_t));
+    char* bytes = (char*)file.data();
+
+    uint32_t* sizes = (uint32_t*)(bytes + HEADER_BYTES);
+    sizes[0] = topology[0];
+    for (size_t l = 0; l < count; l++)
+    {
+      sizes[l + 1] = topology[l + 1];
+      sizes[count + 1 + l] = (uint32_t)activations[l];
+    }
+    size_t offset = table;
+    for (size_t l = 0; l < count; l++)
+    {
+      memcpy(bytes + offset, params[l], blocks[l]);
+      offset += (size_t)Aligned(blocks[l]);
+    }
+
+    Header* header = (Header*)bytes;
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    header->version = VERSION;
+    header->dtype = DTYPE_FLOAT64;
+    header->layers = (uint32_t)count;
+    header->align = ALIGN;
+    header->length = length;
+    header->checksum = checksum(file.data() + HEADER_BYTES / sizeof(uint64_t), (length - HEADER_BYTES) / sizeof(uint64_t));
+
+    return file;
+  }
+
+  bool ModelFile::detect(const std::string& path)
+  {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+  }
+
+  std::shared_ptr<const ModelFile> ModelFile::open(const std::string& path, std::string& error)
+  {
+    std::shared_ptr<ModelFile> file(new ModelFile());
+#ifdef _WIN32
+    // Read once into an aligned buffer.
+    std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+      error = "Cannot open " + path + ".";
+      return nullptr;
+    }
+    file->length = (size_t)in.tellg();
+    file->buffer.resize((file->length + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    in.seekg(0);
+    if (!in.read((char*)file->buffer.data(), file->length))
+    {
+      error = "Cannot read " + path + ".";
+      return nullptr;
+    }
+    file->data = (const char*)file->buffer.data();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      error = "Cannot open " + path + ".";
+      return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)HEADER_BYTES)
+    {
+      ::close(fd);
+      error = path + " is not a model file.";
+      return nullptr;
+    }
+    void* map = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = "Cannot map " + path + ".";
+      return nullptr;
+    }
+    file->data = (const char*)map;
+    file->length = (size_t)info.st_size;
+    file->mapped = true;
+#endif
+
+    if (!file->parse(error))
+    {
+      error = path + ": " + error;
+      return nullptr;
+    }
+    return file;
+  }
+
+  std::shared_ptr<const ModelFile> ModelFile::view(const void* data, size_t capacity, std::string& error)
+  {
+    std::shared_ptr<ModelFile> file(new ModelFile());
+    file->data = (const char*)data;
+    // The file may not fill the memory it sits in.
+    file->length = capacity;
+    if (capacity >= HEADER_BYTES) file->length = (size_t)std::min<uint64_t>(capacity, ((const Header*)data)->length);
+    if (!file->parse(error)) return nullptr;
+    return file;
+  }
+
+  bool ModelFile::parse(std::string& error)
+  {
+    if (length < HEADER_BYTES || memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+    {
+      error = "not a model file.";
+      return false;
+    }
+    const Header* header = (const Header*)data;
+    if (header->version != VERSION)
+    {
+      error = "unsupported format version " + std::to_string(header->version) + ".";
+      return false;
+    }
+    if (header->dtype != DTYPE_FLOAT64 || header->align != ALIGN || header->layers < 1)
+    {
+      error = "unsupported weight layout.";
+      return false;
+    }
+    if (header->length != length)
+    {
+      error = "file is truncated.";
+      return false;
+    }
+
+    // Sizes come from the file, so the arithmetic is done in 64 bits and
+    // checked against length before anything is added to the offset.
+    uint64_t count = header->layers;
+    uint64_t offset = HEADER_BYTES + Aligned((2 * count + 1) * sizeof(uint32_t));
+    if (offset > length)
+    {
+      error = "file is truncated.";
+      return false;
+    }
+    const uint32_t* table = (const uint32_t*)(data + HEADER_BYTES);
+    for (uint64_t l = 0; l <= count; l++)
+    {
+      if (table[l] < 1 || table[l] > INT_MAX)
+      {
+        error = "invalid topology.";
+        return false;
+      }
+    }
+    sizes.assign(table, table + count + 1);
+    for (uint64_t l = 0; l < count; l++)
+    {
+      uint32_t activation = table[count + 1 + l];
+      // Layers index their weights and biases with an int.
+      uint64_t params = ((uint64_t)sizes[l] + 1) * (uint64_t)sizes[l + 1];
+      if (activation > (uint32_t)Activation::Linear || params > INT_MAX)
+      {
+        error = "invalid topology.";
+        return false;
+      }
+      uint64_t bytes = Aligned(params * sizeof(double));
+      if (bytes > length - offset)
+      {
+        error = "weights do not match the topology.";
+        return false;
+      }
+      activations.push_back((Activation)activation);
+      offsets.push_back((size_t)offset);
+      offset += bytes;
+    }
+    if (offset != length)
+    {
+      error = "weights do not match the topology.";
+      return false;
+    }
+
+    const uint64_t* words = (const uint64_t*)data;
+    if (checksum(words + HEADER_BYTES / sizeof(uint64_t), (length - HEADER_BYTES) / sizeof(uint64_t)) != header->checksum)
+    {
+      error = "checksum mismatch.";
+      return false;
+    }
+    return true;
+  }
+
+  const std::vector<int>& ModelFile::topology() const
+  {
+    return sizes;
+  }
+
+  Activation ModelFile::activation(int l) const
+  {
+    return activations[l];
+  }
+
+  const double* ModelFile::params(int l) const
+  {
+    return (const double*)(data + offsets[l]);
+  }
+}
@@ -0,0 +1,297 @@
+#include "model-registry.hh"
+#include "neural-network.hh"
+#include <algorithm>
+
+namespace ANN
+{
+  using v8::ArrayBuffer;
+  using v8::Context;
+  using v8::Exception;
+  using v8::Float64Array;
+  using v8::FunctionTemplate;
+  using v8::Int32Array;
+  using v8::Isolate;
+  using v8::Number;
+  using v8::String;
+
+  Persistent<Function> ModelRegistry::constructor;
+
+  void ModelRegistry::Init(Local<Object> exports)
+  {
+    Isolate* isolate = exports->GetIsolate();
+
+    // Prepare constructor template.
+    Local<FunctionTemplate> tmpl = FunctionTemplate::New(isolate, New);
+    tmpl->SetClassName(String::NewFromUtf8(isolate, "ModelRegistry"));
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Add methods to prototype.
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "register", Register);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "unregister", Unregister);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predict", Predict);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "stats", Stats);
+
+    // Export new item.
+    constructor.Reset(isolate, tmpl->GetFunction());
+    exports->Set(
+      String::NewFromUtf8(isolate, "ModelRegistry"),
+      tmpl->GetFunction()
+    );
+  }
+
+  void ModelRegistry::New(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    if (args.IsConstructCall())
+    {
+      // ModelRegistry invoked as constructor.
+      // Get arguments: optional memory budget in bytes.
+      size_t budget = DEFAULT_BUDGET;
+      if (!args[0]->IsUndefined())
+      {
+        if (!args[0]->IsNumber() || args[0]->NumberValue() < 0)
+        {
+          isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Memory budget must be a number of bytes.")
+          ));
+          return;
+        }
+        budget = (size_t)args[0]->NumberValue();
+      }
+
+      ModelRegistry* registry = new ModelRegistry(budget);
+      registry->Wrap(args.This());
+      args.GetReturnValue().Set(args.This());
+    }
+    else
+    {
+      // ModelRegistry invoked as plain function.
+      const int argc = 1;
+      Local<Value> argv[argc] = { args[0] };
+      Local<Context> context = isolate->GetCurrentContext();
+      Local<Function> construct = Local<Function>::New(isolate, constructor);
+      Local<Object> result = construct->NewInstance(context, argc, argv).ToLocalChecked();
+      args.GetReturnValue().Set(result);
+    }
+  }
+
+  ModelRegistry::ModelRegistry(size_t budget)
+  {
+    this->budget = budget;
+  }
+
+  std::shared_ptr<const Model> ModelRegistry::acquire(const std::string& id, std::string& error)
+  {
+    std::string path;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = entries.find(id);
+      if (found == entries.end())
+      {
+        error = "No model is registered as " + id + ".";
+        return nullptr;
+      }
+      Entry& entry = found->second;
+      if (entry.model)
+      {
+        recency.splice(recency.begin(), recency, entry.use);
+        hits++;
+        return entry.model;
+      }
+      path = entry.path;
+    }
+
+    // Read without holding the lock so other models stay available.
+    std::shared_ptr<const Model> model = Load(path, error);
+    if (!model) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(id);
+    // Re-registered or removed meanwhile: hand out what was read, but do
+    // not keep it.
+    if (found == entries.end() || found->second.path != path) return model;
+    Entry& entry = found->second;
+    // Another thread read it first.
+    if (entry.model) return entry.model;
+    Admit(id, entry, model);
+    return model;
+  }
+
+  std::shared_ptr<const Model> ModelRegistry::Load(const std::string& path, std::string& error)
+  {
+    // Binary files are used in place.
+    if (ModelFile::detect(path))
+    {
+      std::shared_ptr<const ModelFile> file = ModelFile::open(path, error);
+      if (!file) return nullptr;
+      return std::make_shared<const Model>(file);
+    }
+
+    std::vector<int> topology;
+    std::vector<double> weights;
+    if (!NeuralNetwork::ReadSaved(path, topology, weights, error)) return nullptr;
+
+    std::vector<Layer> layers = NeuralNetwork::MakeLayers(topology);
+    size_t k = 0;
+    for (Layer& layer : layers)
+    {
+      std::copy(weights.begin() + k, weights.begin() + k + layer.size(), layer.params.begin());
+      k += layer.size();
+    }
+    return std::make_shared<const Model>(layers);
+  }
+
+  void ModelRegistry::Admit(const std::string& id, Entry& entry, std::shared_ptr<const Model> model)
+  {
+    entry.model = model;
+    entry.bytes = model->bytes();
+    recency.push_front(id);
+    entry.use = recency.begin();
+    resident += entry.bytes;
+    loads++;
+    Evict(id);
+  }
+
+  void ModelRegistry::Evict(const std::string& keep)
+  {
+    // The newest model stays even if it alone exceeds the budget.
+    while (resident > budget && recency.back() != keep)
+    {
+      Entry& entry = entries[recency.back()];
+      resident -= entry.bytes;
+      entry.model.reset();
+      entry.bytes = 0;
+      recency.pop_back();
+      evictions++;
+    }
+  }
+
+  void ModelRegistry::Register(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: id, path.
+    if (!args[0]->IsString() || !args[1]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Expected an id and a path.")
+      ));
+      return;
+    }
+    std::string id(*String::Utf8Value(args[0]));
+    std::string path(*String::Utf8Value(args[1]));
+
+    // Unwrap ModelRegistry.
+    ModelRegistry* registry = ObjectWrap::Unwrap<ModelRegistry>(args.Holder());
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    Entry& entry = registry->entries[id];
+    if (entry.model)
+    {
+      registry->resident -= entry.bytes;
+      registry->recency.erase(entry.use);
+      entry.model.reset();
+      entry.bytes = 0;
+    }
+    entry.path = path;
+  }
+
+  void ModelRegistry::Unregister(const FunctionCallbackInfo<Value>& args)
+  {
+    // Get arguments: id.
+    std::string id(*String::Utf8Value(args[0]));
+
+    // Unwrap ModelRegistry.
+    ModelRegistry* registry = ObjectWrap::Unwrap<ModelRegistry>(args.Holder());
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    auto found = registry->entries.find(id);
+    if (found == registry->entries.end())
+    {
+      args.GetReturnValue().Set(false);
+      return;
+    }
+    if (found->second.model)
+    {
+      registry->resident -= found->second.bytes;
+      registry->recency.erase(found->second.use);
+    }
+    registry->entries.erase(found);
+    args.GetReturnValue().Set(true);
+  }
+
+  void ModelRegistry::Predict(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap ModelRegistry.
+    ModelRegistry* registry = ObjectWrap::Unwrap<ModelRegistry>(args.Holder());
+
+    // Get arguments: id, rows to predict, and optionally 'argmax'.
+    std::string id(*String::Utf8Value(args[0]));
+    bool argmax = args.Length() > 2 && args[2]->IsString()
+      && std::string(*String::Utf8Value(args[2])) == "argmax";
+
+    std::string error;
+    std::shared_ptr<const Model> model = registry->acquire(id, error);
+    if (!model)
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+      return;
+    }
+
+    int numInput = model->numInput();
+    int numOutput = model->numOutput();
+    NeuralNetwork::PredictInput input;
+    std::vector<double> copy;
+    if (!NeuralNetwork::ReadPredictInput(isolate, args[1], numInput, input, copy)) return;
+
+    size_t count = argmax ? (size_t)input.rows : (size_t)input.rows * numOutput;
+    size_t bytes = count * (argmax ? sizeof(int) : sizeof(double));
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, bytes);
+    void* data = buffer->GetContents().Data();
+
+    // Rows go through the model a block at a time.
+    std::vector<double> x((size_t)Model::BLOCK * numInput);
+    std::vector<double> probs((size_t)Model::BLOCK * numOutput);
+    for (int first = 0; first < input.rows; first += Model::BLOCK)
+    {
+      int rows = std::min(Model::BLOCK, input.rows - first);
+      for (int r = 0; r < rows; r++)
+      {
+        NeuralNetwork::CopyRow(input, first + r, numInput, x.data() + (size_t)r * numInput);
+      }
+      double* out = argmax ? probs.data() : (double*)data + (size_t)first * numOutput;
+      model->predict(x.data(), rows, out);
+      if (!argmax) continue;
+      for (int r = 0; r < rows; r++)
+      {
+        const double* p = out + (size_t)r * numOutput;
+        ((int*)data)[first + r] = (int)(std::max_element(p, p + numOutput) - p);
+      }
+    }
+
+    if (argmax) args.GetReturnValue().Set(Int32Array::New(buffer, 0, count));
+    else args.GetReturnValue().Set(Float64Array::New(buffer, 0, count));
+  }
+
+  void ModelRegistry::Stats(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap ModelRegistry.
+    ModelRegistry* registry = ObjectWrap::Unwrap<ModelRegistry>(args.Holder());
+    std::lock_guard<std::mutex> lock(registry->mutex);
+
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "registered"), Number::New(isolate, (double)registry->entries.size()));
+    result->Set(String::NewFromUtf8(isolate, "resident"), Number::New(isolate, (double)registry->recency.size()));
+    result->Set(String::NewFromUtf8(isolate, "bytes"), Number::New(isolate, (double)registry->resident));
+    result->Set(String::NewFromUtf8(isolate, "budget"), Number::New(isolate, (double)registry->budget));
+    result->Set(String::NewFromUtf8(isolate, "loads"), Number::New(isolate, (double)registry->loads));
+    result->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, (double)registry->hits));
+    result->Set(String::NewFromUtf8(isolate, "evictions"), Number::New(isolate, (double)registry->evictions));
+    args.GetReturnValue().Set(result);
+  }
+}
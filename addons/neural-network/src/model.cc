@@ -0,0 +1,140 @@
+#include "model.hh"
+#include "neural-network.hh"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace ANN
+{
+  Model::Model(std::vector<Layer>& layers)
+  {
+    this->topology.push_back(layers.front().inputs);
+    this->params.reserve(layers.size());
+    for (int l = 0; l < layers.size(); l++)
+    {
+      this->topology.push_back(layers[l].outputs);
+      this->activations.push_back(layers[l].activation);
+      this->params.push_back(layers[l].params);
+      this->blocks.push_back(this->params.back().data());
+    }
+  }
+
+  Model::Model(std::shared_ptr<const ModelFile> file)
+  {
+    this->file = file;
+    this->topology = file->topology();
+    for (int l = 0; l + 1 < topology.size(); l++)
+    {
+      this->activations.push_back(file->activation(l));
+      this->blocks.push_back(file->params(l));
+    }
+  }
+
+  int Model::numInput() const
+  {
+    return topology.front();
+  }
+
+  int Model::numOutput() const
+  {
+    return topology.back();
+  }
+
+  const std::vector<int>& Model::sizes() const
+  {
+    return topology;
+  }
+
+  size_t Model::bytes() const
+  {
+    size_t total = 0;
+    for (int l = 0; l + 1 < topology.size(); l++)
+    {
+      total += (size_t)(topology[l] + 1) * topology[l + 1] * sizeof(double);
+    }
+    return total;
+  }
+
+  void Model::predict(const double* x, int rows, double* probs) const
+  {
+    thread_local std::vector<double> scratch;
+    predict(x, rows, probs, scratch);
+  }
+
+  void Model::predict(const double* x, int rows, double* probs, std::vector<double>& scratch) const
+  {
+    int widest = *std::max_element(topology.begin(), topology.end());
+    size_t half = (size_t)BLOCK * widest;
+    if (scratch.size() < 2 * half) scratch.resize(2 * half);
+    int numOutput = topology.back();
+
+    for (int first = 0; first < rows; first += BLOCK)
+    {
+      int count = std::min((int)BLOCK, rows - first);
+      const double* in = x + (size_t)first * topology.front();
+      double* out = scratch.data();
+      for (int l = 0; l < blocks.size(); l++)
+      {
+        Layer::forwardBatch(blocks[l], topology[l], topology[l + 1], activations[l], in, count, out);
+        in = out;
+        out = out == scratch.data() ? scratch.data() + half : scratch.data();
+      }
+
+      for (int r = 0; r < count; r++)
+      {
+        NeuralNetwork::Softmax(in + r * numOutput, numOutput, probs + (size_t)(first + r) * numOutput);
+      }
+    }
+  }
+
+  ModelHandle::ModelHandle(std::shared_ptr<const Model> model)
+  {
+    this->current = new std::shared_ptr<const Model>(model);
+    this->epoch = 0;
+    this->readers[0] = 0;
+    this->readers[1] = 0;
+    this->published = 1;
+  }
+
+  ModelHandle::~ModelHandle()
+  {
+    delete current.load();
+  }
+
+  std::shared_ptr<const Model> ModelHandle::load() const
+  {
+    // Count in, then check the epoch did not move meanwhile; otherwise
+    // the writer may already have stopped waiting for this counter.
+    unsigned int e;
+    while (true)
+    {
+      e = epoch.load();
+      readers[e & 1]++;
+      if (epoch.load() == e) break;
+      readers[e & 1]--;
+    }
+    std::shared_ptr<const Model> model = *current.load();
+    readers[e & 1]--;
+    return model;
+  }
+
+  void ModelHandle::publish(std::shared_ptr<const Model> model)
+  {
+    const std::shared_ptr<const Model>* next = new std::shared_ptr<const Model>(model);
+    std::lock_guard<std::mutex> lock(writing);
+    const std::shared_ptr<const Model>* old = current.exchange(next);
+    // Readers that counted in before the new epoch may still be copying
+    // old; later ones can only see next.
+    unsigned int e = epoch++;
+    while (readers[e & 1].load() != 0) std::this_thread::yield();
+    delete old;
+    published++;
+  }
+
+  long long ModelHandle::version() const
+  {
+    return published;
+  }
+}
@@ -1,8 +1,19 @@
 #include "neural-network.hh"
+#include "blas.hh"
 #include "data-class.hh"
+#include "epoch-log.hh"
+#include "model-file.hh"
+#include "result-cache.hh"
+#include "shared-network.hh"
 #include "tools.hh"
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
 #include <fstream>
+#include <iterator>
 #include <math.h>
+#include <sstream>
+#include <stdio.h>
 #include <string>
 
 #include <iostream>
@@ -10,22 +21,30 @@
 namespace ANN
 {
   using v8::Array;
+  using v8::ArrayBuffer;
+  using v8::ArrayBufferView;
   using v8::Boolean;
   using v8::Context;
   using v8::Exception;
+  using v8::Float64Array;
   using v8::Function;
   using v8::FunctionCallbackInfo;
   using v8::FunctionTemplate;
+  using v8::HandleScope;
+  using v8::Int32Array;
   using v8::Isolate;
   using v8::Local;
+  using v8::Null;
   using v8::Number;
   using v8::Object;
   using v8::Persistent;
   using v8::String;
+  using v8::TypedArray;
   using v8::Value;
 
   Persistent<Function> NeuralNetwork::constructor;
   Random NeuralNetwork::random = Random();
+  int NeuralNetwork::asyncRuns = 0;
 
   void NeuralNetwork::Init(Local<Object> exports)
   {
@@ -40,14 +59,40 @@ namespace ANN
     NODE_SET_PROTOTYPE_METHOD(tmpl, "toString", ToString);
     //NODE_SET_PROTOTYPE_METHOD(tmpl, "initialiseWeights", InitialiseWeights);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "train", Train);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "trainAsync", TrainAsync);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "metrics", Metrics);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "confusion", ConfusionToString);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "accuracy", Accuracy);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predict", Predict);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predictInto", PredictInto);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "quantize", Quantize);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "prune", Prune);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predictCache", PredictCacheSize);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "cacheStats", CacheStats);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "momentumAndDecay", MomentumAndDecay);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "threads", Threads);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "sampledSoftmax", SampledSoftmax);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "save", Save);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "saveBinary", SaveBinary);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "checkpoint", SaveCheckpoint);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "resume", Resume);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "snapshotStats", SnapshotStats);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "publishShared", PublishShared);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "exportCpp", ExportCpp);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "serve", Serve);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "serverStats", ServerStats);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "stopServer", StopServer);
 
     NODE_SET_PROTOTYPE_METHOD(tmpl, "trainingAccuracy", TrainingAccuracy);
     NODE_SET_PROTOTYPE_METHOD(tmpl, "testingAccuracy", TestingAccuracy);
 
+    // Add static methods.
+    NODE_SET_METHOD(tmpl, "blasBackend", BlasBackend);
+    NODE_SET_METHOD(tmpl, "loadBlas", LoadBlas);
+    NODE_SET_METHOD(tmpl, "load", Load);
+    NODE_SET_METHOD(tmpl, "attachShared", AttachShared);
+    NODE_SET_METHOD(tmpl, "seed", Seed);
+
     // Export new item.
     constructor.Reset(isolate, tmpl->GetFunction());
     exports->Set(
@@ -62,34 +107,76 @@ namespace ANN
 
     if (args.IsConstructCall())
     {
-      // NeuralNetwork invoked as constructor.
-      // Get arguments: int numInput, int numHidden, int numOutput.
-      if (args.Length() < 3)
+      if (asyncRuns > 0)
       {
-        isolate->ThrowException(Exception::TypeError(
-          String::NewFromUtf8(isolate, "Too few arguments.")
+        // The initial weights would come from the generator in use.
+        isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Another network is training.")
         ));
         return;
       }
-      std::vector<int> num = std::vector<int>(3);
-      for (int i = 0; i < 3; i++)
+      // NeuralNetwork invoked as constructor.
+      // Get arguments: either an array of layer sizes (input layer first)
+      // or int numInput, int numHidden, int numOutput.
+      std::vector<int> num;
+      if (args[0]->IsArray())
+      {
+        Array* sizes = Array::Cast(*args[0]);
+        for (int i = 0; i < (int)sizes->Length(); i++)
+        {
+          Local<Value> size = sizes->Get(i);
+          if (!size->IsNumber())
+          {
+            isolate->ThrowException(Exception::TypeError(
+              String::NewFromUtf8(isolate, "Layer sizes must be numbers.")
+            ));
+            return;
+          }
+          num.push_back((int)size->NumberValue());
+        }
+      }
+      else
       {
-        if (!args[i]->IsNumber())
+        if (args.Length() < 3)
         {
           isolate->ThrowException(Exception::TypeError(
-            String::NewFromUtf8(
-              isolate,
-              std::string("Argument " + std::to_string(i) + " must be a number.").c_str())
+            String::NewFromUtf8(isolate, "Too few arguments.")
           ));
           return;
         }
-        else
+        for (int i = 0; i < 3; i++)
+        {
+          if (!args[i]->IsNumber())
+          {
+            isolate->ThrowException(Exception::TypeError(
+              String::NewFromUtf8(
+                isolate,
+                std::string("Argument " + std::to_string(i) + " must be a number.").c_str())
+            ));
+            return;
+          }
+          num.push_back((int)args[i]->NumberValue());
+        }
+      }
+      if (num.size() < 2)
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "At least an input and an output layer are required.")
+        ));
+        return;
+      }
+      for (int n : num)
+      {
+        if (n < 1)
         {
-          num[i] = (int)args[i]->NumberValue();
+          isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Layer sizes must be positive.")
+          ));
+          return;
         }
       }
 
-      NeuralNetwork* nn = new NeuralNetwork(num[0], num[1], num[2]);
+      NeuralNetwork* nn = new NeuralNetwork(num);
       nn->Wrap(args.This());
       args.GetReturnValue().Set(args.This());
     }
@@ -106,33 +193,84 @@ namespace ANN
     }
   }
 
-  NeuralNetwork::NeuralNetwork(int numInput, int numHidden, int numOutput)
+  NeuralNetwork::NeuralNetwork(const std::vector<int>& topology)
   {
-    this->numInput = numInput;
-  	this->numHidden = numHidden;
-  	this->numOutput = numOutput;
+    this->topology = topology;
+    this->numInput = topology.front();
+    this->numOutput = topology.back();
 
-  	this->inputs = std::vector<double>(numInput);
+    this->inputs = std::vector<double>(numInput);
 
-  	this->ihWeights = Matrix<double>(numInput, numHidden);
-  	this->hBiases = std::vector<double>(numHidden);
-  	this->hOutputs = std::vector<double>(numHidden);
+    this->layers = MakeLayers(topology);
 
-  	this->hoWeights = Matrix<double>(numHidden, numOutput);
-  	this->oBiases = std::vector<double>(numOutput);
+    this->outputs = std::vector<double>(numOutput);
+    this->sampledStamp = std::vector<int>(numOutput);
+    int widest = *std::max_element(topology.begin(), topology.end());
+    this->sampleValues = std::vector<double>(2 * widest);
 
-  	this->outputs = std::vector<double>(numOutput);
+    this->InitialiseWeights();
+    this->SetThreads(0);
+  }
 
-  	// Back-propagation related arrays below.
-  	this->hGrads = std::vector<double>(numHidden);
-  	this->oGrads = std::vector<double>(numOutput);
+  NeuralNetwork::~NeuralNetwork()
+  {
+    metricsBuffer.Reset();
+  }
 
-  	this->ihPrevWeightsDelta = Matrix<double>(numInput, numHidden);
-  	this->hPrevBiasesDelta = std::vector<double>(numHidden);
-  	this->hoPrevWeightsDelta = Matrix<double>(numHidden, numOutput);
-  	this->oPrevBiasesDelta = std::vector<double>(numOutput);
+  std::vector<Layer> NeuralNetwork::MakeLayers(const std::vector<int>& topology)
+  {
+    // Hidden layers use tanh, the output layer is followed by softmax.
+    std::vector<Layer> layers;
+    for (int l = 1; l < topology.size(); l++)
+    {
+      bool last = l == topology.size() - 1;
+      layers.push_back(Layer(
+        topology[l - 1],
+        topology[l],
+        last ? Activation::Linear : Activation::Tanh
+      ));
+    }
+    return layers;
+  }
 
-    this->InitialiseWeights();
+  bool NeuralNetwork::ReadSaved(const std::string& path, std::vector<int>& topology, std::vector<double>& weights, std::string& error)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "Cannot open " + path + ".";
+      return false;
+    }
+
+    // The first line holds the layer sizes, input layer first.
+    std::string line;
+    std::getline(file, line);
+    std::istringstream sizes(line);
+    topology.clear();
+    int size;
+    while (sizes >> size) topology.push_back(size);
+    if (!sizes.eof() || topology.size() < 2 || *std::min_element(topology.begin(), topology.end()) < 1)
+    {
+      error = path + " does not start with a topology (verbose files cannot be read).";
+      return false;
+    }
+
+    // Then each layer's weights and biases, separated by whitespace.
+    long long count = 0;
+    for (int l = 1; l < topology.size(); l++)
+    {
+      count += (long long)(topology[l - 1] + 1) * topology[l];
+    }
+    weights.clear();
+    weights.reserve((size_t)count);
+    double value;
+    while ((long long)weights.size() < count && file >> value) weights.push_back(value);
+    if ((long long)weights.size() < count || file >> line)
+    {
+      error = path + " does not hold the weights of its topology.";
+      return false;
+    }
+    return true;
   }
 
   void NeuralNetwork::ToString(const FunctionCallbackInfo<Value>& args)
@@ -141,14 +279,15 @@ namespace ANN
 
     // Unwrap NeuralNetwork.
     NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
 
     // Create output string.
     std::string s = "";
   	s += "------------------------------------------\n";
 
-  	s += "numInput = " + std::to_string(nn->numInput) + ", ";
-  	s += "numHidden = " + std::to_string(nn->numHidden) + ", ";
-  	s += "numOutput = " + std::to_string(nn->numOutput) + "\n\n";
+  	s += "topology =";
+  	for (int n : nn->topology) s += " " + std::to_string(n);
+  	s += "\n\n";
 
   	s += "inputs: \n";
   	for (int i = 0; i < nn->inputs.size(); i++)
@@ -157,98 +296,22 @@ namespace ANN
   	}
   	s += "\n\n";
 
-  	s += "ihWeights: \n";
-  	for (int i = 0; i < nn->ihWeights.rows(); i++)
-  	{
-  		for (int j = 0; j < nn->ihWeights.cols(); j++)
-  		{
-  			s += tools::toString(nn->ihWeights[i][j], 4) + " ";
-  		}
-  		s += "\n";
-  	}
-  	s += "\n";
-
-  	s += "hBiases: \n";
-  	for (int i = 0; i < nn->hBiases.size(); i++)
-  	{
-  		s += tools::toString(nn->hBiases[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "hOutputs: \n";
-  	for (int i = 0; i < nn->hOutputs.size(); i++)
-  	{
-  		s += tools::toString(nn->hOutputs[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "hoWeights: \n";
-  	for (int i = 0; i < nn->hoWeights.rows(); i++)
-  	{
-  		for (int j = 0; j < nn->hoWeights.cols(); j++)
-  		{
-  			s += tools::toString(nn->hoWeights[i][j], 4) + " ";
-  		}
-  		s += "\n";
-  	}
-  	s += "\n";
-
-  	s += "oBiases: \n";
-  	for (int i = 0; i < nn->oBiases.size(); i++)
-  	{
-  		s += tools::toString(nn->oBiases[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "hGrads: \n";
-  	for (int i = 0; i < nn->hGrads.size(); i++)
-  	{
-  		s += tools::toString(nn->hGrads[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "oGrads: \n";
-  	for (int i = 0; i < nn->oGrads.size(); i++)
-  	{
-  		s += tools::toString(nn->oGrads[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "ihPrevWeightsDelta: \n";
-  	for (int i = 0; i < nn->ihPrevWeightsDelta.rows(); i++)
-  	{
-  		for (int j = 0; j < nn->ihPrevWeightsDelta.cols(); j++)
-  		{
-  			s += tools::toString(nn->ihPrevWeightsDelta[i][j], 4) + " ";
-  		}
-  		s += "\n";
-  	}
-  	s += "\n";
-
-  	s += "hPrevBiasesDelta: \n";
-  	for (int i = 0; i < nn->hPrevBiasesDelta.size(); i++)
-  	{
-  		s += tools::toString(nn->hPrevBiasesDelta[i], 4) + " ";
-  	}
-  	s += "\n\n";
-
-  	s += "hoPrevWeightsDelta: \n";
-  	for (int i = 0; i < nn->hoPrevWeightsDelta.rows(); i++)
-  	{
-  		for (int j = 0; j < nn->hoPrevWeightsDelta.cols(); j++)
-  		{
-  			s += tools::toString(nn->hoPrevWeightsDelta[i][j], 4) + " ";
-  		}
-  		s += "\n";
-  	}
-  	s += "\n";
-
-  	s += "oPrevBiasesDelta: \n";
-  	for (int i = 0; i < nn->oPrevBiasesDelta.size(); i++)
+  	for (int l = 0; l < nn->layers.size(); l++)
   	{
-  		s += tools::toString(nn->oPrevBiasesDelta[i], 4) + " ";
+  		Layer& layer = nn->layers[l];
+  		std::string name = "layer " + std::to_string(l + 1) + " ";
+  		std::vector<double> biases(layer.biases(), layer.biases() + layer.outputs);
+  		std::vector<double> prevBiases(layer.prevDelta.end() - layer.outputs, layer.prevDelta.end());
+
+  		s += name + "weights: \n";
+  		s += BlockToString(layer.weights(), layer.inputs, layer.outputs) + "\n";
+  		s += name + "biases: \n" + VectorToString(biases) + "\n\n";
+  		s += name + "outputs: \n" + VectorToString(layer.values) + "\n\n";
+  		s += name + "grads: \n" + VectorToString(layer.grads) + "\n\n";
+  		s += name + "prevWeightsDelta: \n";
+  		s += BlockToString(layer.prevDelta.data(), layer.inputs, layer.outputs) + "\n";
+  		s += name + "prevBiasesDelta: \n" + VectorToString(prevBiases) + "\n\n";
   	}
-  	s += "\n\n";
 
   	s += "outputs: \n";
   	for (int i = 0; i < nn->outputs.size(); i++)
@@ -282,65 +345,487 @@ namespace ANN
     Isolate* isolate = args.GetIsolate();
 
     // Get arguments: training data, testing dating, maximum epochs,
-    // learning rate, and log file path.
-    if (args.Length() < 5)
+    // learning rate, log file path (null or empty for no log), and an
+    // optional options object:
+    //   sampler         'importance' to draw rows by their loss
+    //   sampleFraction  draws per epoch as a fraction of the rows
+    //   uniformMix      share of the draw probability spread uniformly
+    //   publishEvery    steps between snapshots for the server (by
+    //                   default, at the end of each epoch only)
+    //   checkpoint      path to write the training state to (see
+    //                   checkpoint())
+    //   checkpointEvery epochs between checkpoints (default 1)
+    //   snapshotPath    file to write weight snapshots to in the binary
+    //                   model format; "{epoch}" is replaced by the epoch
+    //   snapshotEvery   epochs between snapshots
+    //   snapshotOnBest  also take one on each new best test accuracy
+    //   snapshotBuffers snapshots that may wait to be written (default 2)
+    //   snapshotPolicy  'drop' (default) or 'block' when all are waiting
+    //   resultCache     directory of a cache of finished runs (see
+    //                   ResultCache); a run done before is read back
+    //                   instead of repeated. Not used when resuming or
+    //                   with checkpoints or snapshots
+    //   resultCacheBytes size of the cache (default 64 MiB)
+    //   logFormat       'text' (default), 'csv' or 'binary' (see
+    //                   EpochLog)
+    //   logColumns      names of the columns of a csv or binary log
+    //                   (default epoch, trainMSE, testMSE, trainAccuracy,
+    //                   testAccuracy)
+    //   logFlushMs      longest a log line waits to be written (default
+    //                   1000; 0 writes each epoch as it ends)
+    // Returns whether the result came from the cache.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    TrainSettings settings;
+    if (!ReadTrainSettings(args, args.Length(), settings)) return;
+
+    bool cached = false;
+    std::string error;
+    if (!RunTraining(nn, settings, cached, error))
     {
-      isolate->ThrowException(Exception::TypeError(
-        String::NewFromUtf8(isolate, "Too few arguments.")
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
       ));
       return;
     }
-    if (!args[2]->IsNumber() || !args[3]->IsNumber() || !args[4]->IsString())
+    args.GetReturnValue().Set(cached);
+  }
+
+  // A trainAsync() call in progress.
+  struct NeuralNetwork::TrainJob
+  {
+    uv_work_t request;
+    NeuralNetwork* nn;
+    TrainSettings settings;
+    // Copies of the data, which JavaScript is free to change or drop
+    // while the run goes on.
+    std::unique_ptr<DataClass> train;
+    std::unique_ptr<DataClass> test;
+    Persistent<Function> callback;
+    bool ok = false;
+    bool cached = false;
+    std::string error;
+  };
+
+  void NeuralNetwork::TrainAsync(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: those of train(), then a callback taking an error
+    // (or null) and whether the result came from the cache.
+    if (args.Length() < 1 || !args[args.Length() - 1]->IsFunction())
     {
       isolate->ThrowException(Exception::TypeError(
-        String::NewFromUtf8(isolate, "Argument of wrong type passed.")
+        String::NewFromUtf8(isolate, "Last argument must be a callback.")
       ));
       return;
     }
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    TrainJob* job = new TrainJob();
+    if (!ReadTrainSettings(args, args.Length() - 1, job->settings))
+    {
+      delete job;
+      return;
+    }
 
-    DataClass* train = ObjectWrap::Unwrap<DataClass>(args[0]->ToObject());
-    DataClass* test = ObjectWrap::Unwrap<DataClass>(args[1]->ToObject());
-    int maxEpochs = (int)args[2]->NumberValue();
-    double learnRate = args[3]->NumberValue();
-    std::string logFileName(*String::Utf8Value(args[4]));
+    job->request.data = job;
+    job->nn = nn;
+    job->train.reset(new DataClass(job->settings.train->data));
+    job->test.reset(new DataClass(job->settings.test->data));
+    job->settings.train = job->train.get();
+    job->settings.test = job->test.get();
+    job->callback.Reset(isolate, Local<Function>::Cast(args[args.Length() - 1]));
+    nn->Ref();
+    nn->training = true;
+    asyncRuns++;
+    uv_queue_work(uv_default_loop(), &job->request, TrainWork, TrainDone);
+  }
 
-    // Unwrap NeuralNetwork.
+  void NeuralNetwork::TrainWork(uv_work_t* request)
+  {
+    TrainJob* job = (TrainJob*)request->data;
+    job->ok = RunTraining(job->nn, job->settings, job->cached, job->error);
+  }
+
+  void NeuralNetwork::TrainDone(uv_work_t* request, int status)
+  {
+    Isolate* isolate = Isolate::GetCurrent();
+    HandleScope scope(isolate);
+    TrainJob* job = (TrainJob*)request->data;
+    NeuralNetwork* nn = job->nn;
+    nn->training = false;
+    asyncRuns--;
+
+    Local<Value> argv[2] = {
+      job->ok ? Local<Value>(Null(isolate)) : Exception::Error(String::NewFromUtf8(isolate, job->error.c_str())),
+      Boolean::New(isolate, job->cached)
+    };
+    Local<Function> callback = Local<Function>::New(isolate, job->callback);
+    job->callback.Reset();
+    delete job;
+    nn->Unref();
+    node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(), callback, 2, argv);
+  }
+
+  bool NeuralNetwork::Busy(Isolate* isolate, NeuralNetwork* nn)
+  {
+    if (!nn->training) return false;
+    isolate->ThrowException(Exception::Error(
+      String::NewFromUtf8(isolate, "The network is training.")
+    ));
+    return true;
+  }
+
+  void NeuralNetwork::Metrics(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get argument: number of epochs the ring holds.
+    int capacity = 1024;
+    if (args.Length() > 0 && !args[0]->IsUndefined())
+    {
+      if (!args[0]->IsNumber() || args[0]->NumberValue() < 1)
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Capacity must be a positive number.")
+        ));
+        return;
+      }
+      capacity = (int)args[0]->NumberValue();
+    }
     NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    // The buffer is zeroed by V8 and lives as long as the network, so
+    // train() can write to it from another thread.
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, TrainingMetrics::size(capacity) * sizeof(double));
+    nn->metrics.reset(new TrainingMetrics((double*)buffer->GetContents().Data(), capacity));
+    nn->metricsBuffer.Reset(isolate, buffer);
+    args.GetReturnValue().Set(buffer);
+  }
 
-    // Initialise accuracy vectors.
-    nn->trainingAccuracy = std::vector<double>(maxEpochs);
-    nn->testingAccuracy = std::vector<double>(maxEpochs);
+  bool NeuralNetwork::ReadTrainSettings(const FunctionCallbackInfo<Value>& args, int count, TrainSettings& settings)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    if (count < 4)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Too few arguments.")
+      ));
+      return false;
+    }
+    Local<Value> logPath = count > 4 ? args[4] : Local<Value>(Null(isolate));
+    if (!args[2]->IsNumber() || !args[3]->IsNumber()
+      || !(logPath->IsString() || logPath->IsNull() || logPath->IsUndefined()))
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument of wrong type passed.")
+      ));
+      return false;
+    }
+    if (asyncRuns > 0)
+    {
+      // The random generator is shared with the run on the other thread.
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return false;
+    }
+
+    settings.train = ObjectWrap::Unwrap<DataClass>(args[0]->ToObject());
+    settings.test = ObjectWrap::Unwrap<DataClass>(args[1]->ToObject());
+    settings.maxEpochs = (int)args[2]->NumberValue();
+    settings.learnRate = args[3]->NumberValue();
+    if (logPath->IsString()) settings.logFileName = *String::Utf8Value(logPath);
+
+    // Read options.
+    settings.cacheBytes = ResultCache::DEFAULT_BUDGET;
+    settings.logColumns = { LogColumn::Epoch, LogColumn::TrainMSE, LogColumn::TestMSE,
+      LogColumn::TrainAccuracy, LogColumn::TestAccuracy };
+    if (count > 5 && args[5]->IsObject())
+    {
+      Local<Object> options = args[5]->ToObject();
+      Local<Value> every = options->Get(String::NewFromUtf8(isolate, "publishEvery"));
+      if (every->IsNumber()) settings.publishEvery = (int)every->NumberValue();
+      Local<Value> path = options->Get(String::NewFromUtf8(isolate, "checkpoint"));
+      if (path->IsString()) settings.checkpointPath = *String::Utf8Value(path);
+      every = options->Get(String::NewFromUtf8(isolate, "checkpointEvery"));
+      if (every->IsNumber()) settings.checkpointEvery = std::max(1, (int)every->NumberValue());
+      path = options->Get(String::NewFromUtf8(isolate, "snapshotPath"));
+      if (path->IsString()) settings.snapshotPath = *String::Utf8Value(path);
+      every = options->Get(String::NewFromUtf8(isolate, "snapshotEvery"));
+      if (every->IsNumber()) settings.snapshotEvery = (int)every->NumberValue();
+      settings.snapshotOnBest = options->Get(String::NewFromUtf8(isolate, "snapshotOnBest"))->BooleanValue();
+      Local<Value> value = options->Get(String::NewFromUtf8(isolate, "snapshotBuffers"));
+      if (value->IsNumber()) settings.snapshotBuffers = std::max(1, (int)value->NumberValue());
+      value = options->Get(String::NewFromUtf8(isolate, "snapshotPolicy"));
+      if (value->IsString() && std::string(*String::Utf8Value(value)) == "block") settings.snapshotPolicy = SnapshotPolicy::Block;
+      path = options->Get(String::NewFromUtf8(isolate, "resultCache"));
+      if (path->IsString()) settings.cachePath = *String::Utf8Value(path);
+      value = options->Get(String::NewFromUtf8(isolate, "resultCacheBytes"));
+      if (value->IsNumber()) settings.cacheBytes = (long long)value->NumberValue();
+      value = options->Get(String::NewFromUtf8(isolate, "logFormat"));
+      if (value->IsString())
+      {
+        std::string name(*String::Utf8Value(value));
+        if (name == "csv") settings.logFormat = LogFormat::Csv;
+        else if (name == "binary") settings.logFormat = LogFormat::Binary;
+      }
+      value = options->Get(String::NewFromUtf8(isolate, "logColumns"));
+      if (value->IsArray())
+      {
+        Local<Array> names = Local<Array>::Cast(value);
+        settings.logColumns.clear();
+        for (unsigned i = 0; i < names->Length(); i++)
+        {
+          std::string name(*String::Utf8Value(names->Get(i)));
+          LogColumn column;
+          if (!EpochLog::parseColumn(name, column))
+          {
+            isolate->ThrowException(Exception::TypeError(
+              String::NewFromUtf8(isolate, ("Unknown log column '" + name + "'.").c_str())
+            ));
+            return false;
+          }
+          settings.logColumns.push_back(column);
+        }
+      }
+      value = options->Get(String::NewFromUtf8(isolate, "logFlushMs"));
+      if (value->IsNumber()) settings.logFlushMillis = std::max(0, (int)value->NumberValue());
+      Local<Value> samplerName = options->Get(String::NewFromUtf8(isolate, "sampler"));
+      if (samplerName->IsString() && std::string(*String::Utf8Value(samplerName)) == "importance")
+      {
+        settings.importance = true;
+        Local<Value> value = options->Get(String::NewFromUtf8(isolate, "sampleFraction"));
+        if (value->IsNumber()) settings.sampleFraction = value->NumberValue();
+        value = options->Get(String::NewFromUtf8(isolate, "uniformMix"));
+        if (value->IsNumber()) settings.uniformMix = value->NumberValue();
+      }
+    }
+    return true;
+  }
+
+  bool NeuralNetwork::RunTraining(NeuralNetwork* nn, const TrainSettings& settings, bool& cached, std::string& error)
+  {
+    DataClass* train = settings.train;
+    DataClass* test = settings.test;
+    int maxEpochs = settings.maxEpochs;
+    double learnRate = settings.learnRate;
+    const std::string& logFileName = settings.logFileName;
+    int publishEvery = settings.publishEvery;
+    const std::string& checkpointPath = settings.checkpointPath;
+    int checkpointEvery = settings.checkpointEvery;
+    const std::string& snapshotPath = settings.snapshotPath;
+    int snapshotEvery = settings.snapshotEvery;
+    bool snapshotOnBest = settings.snapshotOnBest;
+    cached = false;
+
+    // A resumed state that does not fit this run is an error rather than
+    // a fresh start, which would throw the epochs done away. The sampler
+    // draws a fresh order every epoch, so only its losses carry over.
+    if (nn->resumed)
+    {
+      size_t rows = settings.importance ? nn->resumedLosses.size() : nn->order.size();
+      if (nn->epoch > maxEpochs)
+      {
+        error = "The checkpoint is at epoch " + std::to_string(nn->epoch) + " but maxEpochs is " + std::to_string(maxEpochs) + ".";
+        return false;
+      }
+      if (settings.importance && rows == 0)
+      {
+        error = "The checkpoint was not trained with importance sampling.";
+        return false;
+      }
+      if (rows != train->data.rows())
+      {
+        error = "The checkpoint has " + std::to_string(rows) + " rows, the training data has " + std::to_string(train->data.rows()) + ".";
+        return false;
+      }
+    }
+
+    // The quantized and sparse copies no longer match once the weights
+    // move.
+    nn->quantized.clear();
+    nn->sparse = false;
+    for (int l = 0; l < nn->layers.size(); l++) nn->layers[l].densify();
+    if (nn->cache) nn->cache->clear();
+
+    nn->sampler.reset();
+    if (settings.importance)
+    {
+      nn->sampler.reset(new ImportanceSampler(train->data.rows(), settings.sampleFraction, settings.uniformMix));
+    }
+
+    // Keep the snapshot writer (and anything it still has queued) unless
+    // its settings changed.
+    if (!snapshotPath.empty() && (!nn->snapshots || nn->snapshots->buffers() != settings.snapshotBuffers
+      || nn->snapshots->policy() != settings.snapshotPolicy))
+    {
+      nn->snapshots.reset(new SnapshotWriter(settings.snapshotBuffers, settings.snapshotPolicy));
+    }
+
+    // Carry on from the resumed state, checked above.
+    bool resuming = nn->resumed;
+    nn->resumed = false;
+    if (resuming && nn->sampler) nn->sampler->losses = nn->resumedLosses;
+    nn->resumedLosses.clear();
+
+    // Look the run up in the result cache. The key covers everything the
+    // outcome depends on: the data as it stands after any preprocessing
+    // and splitting, the network and its starting weights, the arguments,
+    // and the state of the random generator (fixed by seed()). The
+    // thread count and backend are included as they change the order of
+    // the sums.
+    std::unique_ptr<ResultCache> results;
+    ResultCache::Key resultKey;
+    // Training and testing error of each epoch, for the cache.
+    std::vector<double> errors;
+    if (!settings.cachePath.empty() && !resuming && checkpointPath.empty() && snapshotPath.empty())
+    {
+      ResultCache::Key& key = resultKey;
+      for (Matrix<double>* data : { &train->data, &test->data })
+      {
+        key.value(data->rows());
+        for (int i = 0; i < data->rows(); i++) key.vector((*data)[i]);
+      }
+      key.vector(nn->topology);
+      for (Layer& layer : nn->layers)
+      {
+        key.vector(layer.params);
+        key.vector(layer.prevDelta);
+      }
+      key.value(nn->momentum);
+      key.value(nn->weightDecay);
+      key.value(nn->numSampled);
+      key.value(nn->Workers());
+      key.add(blas::active().name);
+      key.value(maxEpochs);
+      key.value(learnRate);
+      key.value(nn->sampler ? nn->sampler->fraction : -1.0);
+      key.value(nn->sampler ? nn->sampler->mix : -1.0);
+      key.add(random.state());
+      // The log is kept as written, and only when one was written.
+      key.value(!logFileName.empty());
+      key.value((int)settings.logFormat);
+      for (LogColumn column : settings.logColumns) key.value((int)column);
+      results.reset(new ResultCache(settings.cachePath, settings.cacheBytes));
+
+      Checkpoint state;
+      std::string cachedLog;
+      if (results->get(resultKey, state, cachedLog, errors) && errors.size() == 2 * (size_t)state.epoch &&
+        nn->RestoreTrainingState(state, error))
+      {
+        // The state is that at the end of the run, random generator
+        // included, so what follows carries on as if it had been trained.
+        nn->resumed = false;
+        if (nn->sampler) nn->sampler->losses = nn->resumedLosses;
+        nn->resumedLosses.clear();
+        if (!logFileName.empty() && !tools::writeFile(logFileName, cachedLog.data(), cachedLog.size(), error))
+        {
+          return false;
+        }
+        if (nn->metrics)
+        {
+          nn->metrics->start();
+          for (int e = 0; e < nn->epoch; e++)
+          {
+            nn->metrics->push(e + 1, errors[2 * e], errors[2 * e + 1], nn->trainingAccuracy[e], nn->testingAccuracy[e], 0.0);
+          }
+          nn->metrics->stop();
+        }
+        cached = true;
+        return true;
+      }
+      errors.clear();
+    }
+
+    // Initialise accuracy vectors, keeping the epochs already done.
+    if (!resuming)
+    {
+      nn->epoch = 0;
+      nn->trainingAccuracy.clear();
+      nn->testingAccuracy.clear();
+    }
+    nn->trainingAccuracy.resize(maxEpochs);
+    nn->testingAccuracy.resize(maxEpochs);
 
     // Train a back-propagation style NN classifier using learning rate
   	// and momentum. Weight decay reduces the magnitude of a weight
   	// value over time unless that value is constantly increased.
-  	int epoch = 0;
+  	int& epoch = nn->epoch;
   	std::vector<double> xValues = std::vector<double>(nn->numInput);
   	std::vector<double> tValues = std::vector<double>(nn->numOutput);
 
-  	std::vector<int> sequence = std::vector<int>(train->data.rows());
-  	for (int i = 0; i < sequence.size(); i++) sequence[i] = i;
-
-  	// Train the NN while writing results to the log file.
-  	// Open and truncate output log file for writing.
-  	std::ofstream log;
-  	log.open(logFileName, std::ios::out | std::ios::trunc);
+  	std::vector<int>& sequence = nn->order;
+  	if (!resuming)
+  	{
+  		sequence = std::vector<int>(train->data.rows());
+  		for (int i = 0; i < sequence.size(); i++) sequence[i] = i;
+  	}
+  	// Importance weight of each entry in sequence.
+  	std::vector<double> weights = std::vector<double>(sequence.size(), 1.0);
+  	// First checkpoint that could not be written, if any.
+  	std::string checkpointError;
+  	// Best test accuracy so far, for snapshotOnBest.
+  	double bestAccuracy = -1.0;
+
+  	// Train the NN while writing results to the log file, from a thread
+  	// of its own. Open and truncate output log file for writing (a
+  	// resumed run adds to it).
+  	std::unique_ptr<EpochLog> log;
+  	if (nn->metrics) nn->metrics->start();
+  	if (!logFileName.empty()) log.reset(new EpochLog(logFileName, resuming, settings.logFormat, settings.logColumns, settings.logFlushMillis));
+  	// Training steps since the last published snapshot.
+  	int steps = 0;
 
   	while (epoch < maxEpochs)
   	{
-  		// Visit each training data in random order.
-  		Shuffle(sequence);
-  		for (int i = 0; i < train->data.rows(); i++)
+  		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  		// Visit each training data in random order, or draw rows by
+  		// their last seen loss.
+  		if (nn->sampler) nn->sampler->draw(random, sequence, weights);
+  		else Shuffle(sequence);
+  		for (int i = 0; i < sequence.size(); i++)
   		{
+  			if (publishEvery > 0 && ++steps >= publishEvery)
+  			{
+  				nn->Publish();
+  				steps = 0;
+  			}
   			int idx = sequence[i];
+  			// Scaling the step by the importance weight keeps the expected
+  			// update the same as for a uniform pass.
+  			double rate = learnRate * weights[i];
   			xValues.assign(train->data[idx].begin(), train->data[idx].begin() + nn->numInput);
   			tValues.assign(train->data[idx].begin() + nn->numInput, train->data[idx].end());
+  			if (nn->numSampled > 0)
+  			{
+  				// Only the target and a sample of other classes are used.
+  				double loss = nn->UpdateWeightsSampled(xValues, MaxIndex(tValues), rate);
+  				if (nn->sampler) nn->sampler->update(idx, loss);
+  				continue;
+  			}
   			// Copy xValues in, compute outputs (store them internally).
   			nn->ComputeOutputs(xValues);
+  			if (nn->sampler)
+  			{
+  				double loss = 0.0;
+  				for (int j = 0; j < nn->numOutput; j++)
+  				{
+  					double err = tValues[j] - nn->outputs[j];
+  					loss += err * err;
+  				}
+  				nn->sampler->update(idx, loss);
+  			}
   			// Find better weights.
-  			nn->UpdateWeights(tValues, learnRate);
+  			nn->UpdateWeights(tValues, rate);
   		}
 
+  		nn->Publish();
+  		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
   		// To convert to percent: x * 100.
   		double trainAccuracy = nn->AccuracyHelper(train->data) * 100;
   		double testAccuracy = nn->AccuracyHelper(test->data) * 100;
@@ -351,77 +836,327 @@ namespace ANN
       nn->trainingAccuracy[epoch] = trainAccuracy;
       nn->testingAccuracy[epoch] = testAccuracy;
 
-  		// Put together output string.
-  		std::string output = "";
-  		output += std::to_string(epoch + 1) + " ";
-  		output += std::to_string(trainMSE) + " " + std::to_string(testMSE) + " ";
-  		output += tools::toString(trainAccuracy, 2) + "% ";
-  		output += tools::toString(testAccuracy, 2) + "%\n";
+  		// Kept for the result cache, which replays them to metrics().
+  		if (results)
+  		{
+  			errors.push_back(trainMSE);
+  			errors.push_back(testMSE);
+  		}
+
+  		// Show the epoch to readers of metrics().
+  		if (nn->metrics)
+  		{
+  			nn->metrics->push(epoch + 1, trainMSE, testMSE, trainAccuracy, testAccuracy,
+  				seconds > 0.0 ? sequence.size() / seconds : 0.0);
+  		}
 
-  		// Write output to log file.
-  		log << output;
+  		// Queue the epoch's line for the log writer, with the number of
+  		// distinct rows the sampler visited this epoch.
+  		if (log)
+  		{
+  			EpochRecord record;
+  			record.epoch = epoch + 1;
+  			record.trainMSE = trainMSE;
+  			record.testMSE = testMSE;
+  			record.trainAccuracy = trainAccuracy;
+  			record.testAccuracy = testAccuracy;
+  			record.visited = nn->sampler ? nn->sampler->visited() : -1;
+  			record.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  			log->push(record);
+  		}
 
   		// Increment counter epoch.
   		epoch++;
+
+  		// Hand a copy of the weights to the snapshot writer.
+  		bool best = testAccuracy > bestAccuracy;
+  		if (best) bestAccuracy = testAccuracy;
+  		if (!snapshotPath.empty() && ((snapshotEvery > 0 && epoch % snapshotEvery == 0) || (snapshotOnBest && best)))
+  		{
+  			std::string path = snapshotPath;
+  			size_t at = path.find("{epoch}");
+  			if (at != std::string::npos) path.replace(at, 7, std::to_string(epoch));
+  			nn->snapshots->submit(path, nn->layers);
+  		}
+
+  		if (!checkpointPath.empty() && (epoch % checkpointEvery == 0 || epoch == maxEpochs))
+  		{
+  			std::string error;
+  			if (!nn->TrainingState().write(checkpointPath, error) && checkpointError.empty())
+  			{
+  				checkpointError = error;
+  			}
+  		}
   	}
 
-  	// Close output log file.
-  	log.close();
+  	// Close output log file once the writer has caught up.
+  	error = checkpointError;
+  	if (log && !log->close() && error.empty()) error = "Cannot write " + logFileName + ".";
+  	log.reset();
+  	if (nn->metrics) nn->metrics->stop();
+
+  	if (results)
+  	{
+  		// The log is stored as it was written.
+  		std::string logText;
+  		if (!logFileName.empty())
+  		{
+  			std::ifstream file(logFileName, std::ios::in | std::ios::binary);
+  			logText.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  		}
+  		std::string cacheError;
+  		if (!results->put(resultKey, nn->TrainingState(), logText, errors, cacheError) && error.empty()) error = cacheError;
+  	}
+  	return error.empty();
   }
 
-  void NeuralNetwork::ConfusionToString(const FunctionCallbackInfo<Value>& args)
+  void NeuralNetwork::Seed(const FunctionCallbackInfo<Value>& args)
   {
     Isolate* isolate = args.GetIsolate();
-
-    // Unwrap NeuralNetwork.
-    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
-
-    std::string output = "";
-
-    std::string divider = "";
-    for (int i = 0; i < nn->numOutput * 7; i++)
+    if (!args[0]->IsNumber())
     {
-      divider += "-";
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a number.")
+      ));
+      return;
     }
-
-    for (int y = 0; y < nn->numOutput; y++)
+    if (asyncRuns > 0)
     {
-      for (int x = 0; x < nn->numOutput; x++)
-      {
-        std::string temp = std::to_string(nn->confusionMatrix[x][y]);
-        temp.insert(temp.begin(), 4 - temp.length(), ' ');
-        //temp.append(8 - temp.length(), 'X');
-        //temp = tools::pad(temp, 4);
-        output += temp + " ";
-        if (x != nn->numOutput - 1) output += "| ";
-      }
-      output += "\n";
-      if (y != nn->numOutput - 1) output += divider + "\n";
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
     }
-
-    // Return confusion matrix as a string.
-    args.GetReturnValue().Set(String::NewFromUtf8(isolate, output.c_str()));
+    unsigned value = args[0]->Uint32Value();
+    random.seed(value);
+    DataClass::random.seed(value);
   }
 
-  void NeuralNetwork::Accuracy(const FunctionCallbackInfo<Value>& args)
+  void NeuralNetwork::SaveCheckpoint(const FunctionCallbackInfo<Value>& args)
   {
     Isolate* isolate = args.GetIsolate();
-
-    // Check if the passed argument is an array.
-    /*
-    if (!args[0]->IsArray())
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    // Get arguments: path.
+    if (!args[0]->IsString())
     {
       isolate->ThrowException(Exception::TypeError(
-        String::NewFromUtf8(isolate, "Argument must be an array.")
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
       ));
       return;
     }
-    // Get argument as array.
-    Array* input = Array::Cast(*args[0]);
-    // Convert input array to matrix.
-    Matrix<double> testData = Matrix<double>(input->Length());
-    int cols = 0;
-    for (int i = 0; i < input->Length(); i++)
+    std::string path(*String::Utf8Value(args[0]));
+
+    if (asyncRuns > 0)
+    {
+      // The checkpoint reads the state of the generator in use.
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
+    }
+
+    std::string error;
+    if (!nn->TrainingState().write(path, error))
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+    }
+  }
+
+  void NeuralNetwork::Resume(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    // Get arguments: path.
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
+      ));
+      return;
+    }
+    std::string path(*String::Utf8Value(args[0]));
+
+    if (asyncRuns > 0)
+    {
+      // Restoring the checkpoint replaces the state of the generator in use.
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
+    }
+
+    Checkpoint state;
+    std::string error;
+    if (!state.read(path, error) || !nn->RestoreTrainingState(state, error))
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+      return;
+    }
+    args.GetReturnValue().Set(nn->epoch);
+  }
+
+  void NeuralNetwork::SnapshotStats(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (!nn->snapshots)
+    {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+
+    SnapshotWriter& writer = *nn->snapshots;
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "written"), Number::New(isolate, (double)writer.written()));
+    result->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, (double)writer.dropped()));
+    result->Set(String::NewFromUtf8(isolate, "failed"), Number::New(isolate, (double)writer.failed()));
+    result->Set(String::NewFromUtf8(isolate, "pending"), Number::New(isolate, writer.pending()));
+    result->Set(String::NewFromUtf8(isolate, "error"), String::NewFromUtf8(isolate, writer.lastError().c_str()));
+    args.GetReturnValue().Set(result);
+  }
+
+  Checkpoint NeuralNetwork::TrainingState()
+  {
+    Checkpoint state;
+    state.topology = topology;
+    for (Layer& layer : layers)
+    {
+      state.params.push_back(layer.params);
+      state.prevDelta.push_back(layer.prevDelta);
+    }
+    state.momentum = momentum;
+    state.weightDecay = weightDecay;
+    state.epoch = epoch;
+    int done = std::min(epoch, (int)trainingAccuracy.size());
+    state.trainingAccuracy.assign(trainingAccuracy.begin(), trainingAccuracy.begin() + done);
+    state.testingAccuracy.assign(testingAccuracy.begin(), testingAccuracy.begin() + done);
+    state.order = order;
+    state.random = random.state();
+    if (sampler) state.losses = sampler->losses;
+    return state;
+  }
+
+  bool NeuralNetwork::RestoreTrainingState(const Checkpoint& state, std::string& error)
+  {
+    if (state.topology != topology)
+    {
+      error = "The checkpoint is of a network with another topology.";
+      return false;
+    }
+    for (int l = 0; l < layers.size(); l++)
+    {
+      if (state.params[l].size() != layers[l].params.size() || state.prevDelta[l].size() != layers[l].prevDelta.size())
+      {
+        error = "The checkpoint does not hold the weights of its topology.";
+        return false;
+      }
+    }
+    if (!random.restore(state.random))
+    {
+      error = "The checkpoint holds no random generator state.";
+      return false;
+    }
+
+    for (int l = 0; l < layers.size(); l++)
+    {
+      layers[l].params = state.params[l];
+      layers[l].prevDelta = state.prevDelta[l];
+      layers[l].densify();
+    }
+    quantized.clear();
+    sparse = false;
+    if (cache) cache->clear();
+    Publish();
+
+    momentum = state.momentum;
+    weightDecay = state.weightDecay;
+    epoch = state.epoch;
+    trainingAccuracy = state.trainingAccuracy;
+    testingAccuracy = state.testingAccuracy;
+    order = state.order;
+    resumedLosses = state.losses;
+    resumed = true;
+    return true;
+  }
+
+  void NeuralNetwork::ConfusionToString(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    std::string output = "";
+
+    // Too many classes to draw as a table, so list the non-zero cells.
+    if (nn->numOutput > CONFUSION_TABLE_LIMIT)
+    {
+      for (auto& cell : nn->confusionMatrix)
+      {
+        output += std::to_string(cell.first.first) + " -> ";
+        output += std::to_string(cell.first.second) + ": ";
+        output += std::to_string(cell.second) + "\n";
+      }
+      args.GetReturnValue().Set(String::NewFromUtf8(isolate, output.c_str()));
+      return;
+    }
+
+    std::string divider = "";
+    for (int i = 0; i < nn->numOutput * 7; i++)
+    {
+      divider += "-";
+    }
+
+    for (int y = 0; y < nn->numOutput; y++)
+    {
+      for (int x = 0; x < nn->numOutput; x++)
+      {
+        auto cell = nn->confusionMatrix.find(std::make_pair(x, y));
+        int count = cell == nn->confusionMatrix.end() ? 0 : cell->second;
+        std::string temp = std::to_string(count);
+        temp.insert(temp.begin(), 4 - temp.length(), ' ');
+        //temp.append(8 - temp.length(), 'X');
+        //temp = tools::pad(temp, 4);
+        output += temp + " ";
+        if (x != nn->numOutput - 1) output += "| ";
+      }
+      output += "\n";
+      if (y != nn->numOutput - 1) output += divider + "\n";
+    }
+
+    // Return confusion matrix as a string.
+    args.GetReturnValue().Set(String::NewFromUtf8(isolate, output.c_str()));
+  }
+
+  void NeuralNetwork::Accuracy(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Check if the passed argument is an array.
+    /*
+    if (!args[0]->IsArray())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument must be an array.")
+      ));
+      return;
+    }
+    // Get argument as array.
+    Array* input = Array::Cast(*args[0]);
+    // Convert input array to matrix.
+    Matrix<double> testData = Matrix<double>(input->Length());
+    int cols = 0;
+    for (int i = 0; i < input->Length(); i++)
     {
       Local<Value> val = input->Get(i);
       if (val->IsArray())
@@ -443,6 +1178,7 @@ namespace ANN
 
     // Unwrap NeuralNetwork.
     NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
     args.GetReturnValue().Set(nn->AccuracyHelper(cls->data));
   }
 
@@ -458,7 +1194,7 @@ namespace ANN
   	// Computed y.
   	std::vector<double> yValues;
 
-    confusionMatrix = Matrix<int>(numOutput, numInput);
+    confusionMatrix.clear();
 
   	for (int i = 0; i < testData.rows(); i++)
   	{
@@ -474,55 +1210,804 @@ namespace ANN
       if (maxIndexOut == maxIndexExpected) numCorrect++;
   		else ++numWrong;
 
-      confusionMatrix[maxIndexExpected][maxIndexOut] += 1;
+      confusionMatrix[std::make_pair(maxIndexExpected, maxIndexOut)] += 1;
   	}
 
-  	if (numCorrect == 0 && numWrong == 0) return 0;
-  	else return (numCorrect * 1.0) / (numCorrect + numWrong);
+  	if (numCorrect == 0 && numWrong == 0) return 0;
+  	else return (numCorrect * 1.0) / (numCorrect + numWrong);
+  }
+
+  void NeuralNetwork::Predict(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    // Get arguments: rows to predict, and optionally 'argmax'.
+    bool argmax = args.Length() > 1 && args[1]->IsString()
+      && std::string(*String::Utf8Value(args[1])) == "argmax";
+
+    PredictInput input;
+    // Holds the rows of a JavaScript array.
+    std::vector<double> copy;
+    if (!ReadPredictInput(isolate, args[0], nn->numInput, input, copy)) return;
+
+    // Allocate the result and let the network write straight into it.
+    size_t count = argmax ? (size_t)input.rows : (size_t)input.rows * nn->numOutput;
+    size_t bytes = count * (argmax ? sizeof(int) : sizeof(double));
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, bytes);
+    void* data = buffer->GetContents().Data();
+    if (argmax)
+    {
+      nn->PredictBatch(input, nullptr, (int*)data);
+      args.GetReturnValue().Set(Int32Array::New(buffer, 0, count));
+    }
+    else
+    {
+      nn->PredictBatch(input, (double*)data, nullptr);
+      args.GetReturnValue().Set(Float64Array::New(buffer, 0, count));
+    }
+  }
+
+  bool NeuralNetwork::ReadPredictInput(Isolate* isolate, Local<Value> value, int numInput, PredictInput& input, std::vector<double>& copy)
+  {
+    int length;
+    bool isDouble;
+    if (void* data = TypedArrayData(value, length, isDouble))
+    {
+      if (length % numInput != 0)
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Array length must be a multiple of the number of inputs.")
+        ));
+        return false;
+      }
+      if (isDouble) input.f64 = (const double*)data;
+      else input.f32 = (const float*)data;
+      input.rows = length / numInput;
+    }
+    else if (value->IsArray())
+    {
+      Array* rows = Array::Cast(*value);
+      input.rows = (int)rows->Length();
+      copy = std::vector<double>((size_t)input.rows * numInput);
+      for (int i = 0; i < input.rows; i++)
+      {
+        Local<Value> item = rows->Get(i);
+        Array* row = item->IsArray() ? Array::Cast(*item) : nullptr;
+        if (!row || (int)row->Length() < numInput)
+        {
+          isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Each row must be an array of at least as many numbers as inputs.")
+          ));
+          return false;
+        }
+        for (int j = 0; j < numInput; j++)
+        {
+          copy[(size_t)i * numInput + j] = row->Get(j)->NumberValue();
+        }
+      }
+      input.f64 = copy.data();
+    }
+    else if (value->IsObject() && value->ToObject()->InternalFieldCount() > 0)
+    {
+      DataClass* cls = ObjectWrap::Unwrap<DataClass>(value->ToObject());
+      if (cls->data.rows() > 0 && cls->data.cols() < numInput)
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Data has fewer columns than the network has inputs.")
+        ));
+        return false;
+      }
+      input.matrix = &cls->data;
+      input.rows = cls->data.rows();
+    }
+    else
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be a DataClass, a Float64Array, a Float32Array or an array of rows.")
+      ));
+      return false;
+    }
+    return true;
+  }
+
+  void NeuralNetwork::CopyRow(const PredictInput& input, int row, int numInput, double* x)
+  {
+    size_t offset = (size_t)row * numInput;
+    if (input.f64) std::copy(input.f64 + offset, input.f64 + offset + numInput, x);
+    else if (input.f32) std::copy(input.f32 + offset, input.f32 + offset + numInput, x);
+    else std::copy((*input.matrix)[row].begin(), (*input.matrix)[row].begin() + numInput, x);
+  }
+
+  void NeuralNetwork::PredictInto(const FunctionCallbackInfo<Value>& args)
+  {
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+
+    // Get arguments: input typed array, output typed array.
+    int inLength, outLength;
+    bool inDouble, outDouble;
+    void* in = TypedArrayData(args[0], inLength, inDouble);
+    void* out = TypedArrayData(args[1], outLength, outDouble);
+    if (nn->training || !in || !out || inLength < nn->numInput || outLength < nn->numOutput)
+    {
+      args.GetReturnValue().Set(false);
+      return;
+    }
+
+    // Run the sample through the network's own buffers.
+    if (inDouble) std::copy((double*)in, (double*)in + nn->numInput, nn->inputs.begin());
+    else std::copy((float*)in, (float*)in + nn->numInput, nn->inputs.begin());
+    // Answer from the cache where possible.
+    if (nn->cache)
+    {
+      double* probs = outDouble ? (double*)out : nn->outputs.data();
+      if (nn->cache->find(nn->inputs.data(), probs))
+      {
+        if (!outDouble) std::copy(nn->outputs.begin(), nn->outputs.end(), (float*)out);
+        args.GetReturnValue().Set(true);
+        return;
+      }
+    }
+
+    const double* sums;
+    double* a = nn->sampleValues.data();
+    double* b = a + nn->sampleValues.size() / 2;
+    if (!nn->quantized.empty())
+    {
+      sums = nn->QuantizedForward(nn->inputs.data(), a, b, nn->quantizedScratch.data());
+    }
+    else if (nn->sparse)
+    {
+      sums = nn->SparseForward(nn->inputs.data(), a, b);
+    }
+    else
+    {
+      nn->Forward();
+      sums = nn->layers.back().values.data();
+    }
+
+    if (outDouble)
+    {
+      Softmax(sums, nn->numOutput, (double*)out);
+      if (nn->cache) nn->cache->insert(nn->inputs.data(), (double*)out);
+    }
+    else
+    {
+      Softmax(sums, nn->numOutput, nn->outputs.data());
+      if (nn->cache) nn->cache->insert(nn->inputs.data(), nn->outputs.data());
+      std::copy(nn->outputs.begin(), nn->outputs.end(), (float*)out);
+    }
+    args.GetReturnValue().Set(true);
+  }
+
+  void* NeuralNetwork::TypedArrayData(Local<Value> value, int& length, bool& isDouble)
+  {
+    isDouble = value->IsFloat64Array();
+    if (!isDouble && !value->IsFloat32Array()) return nullptr;
+    ArrayBufferView* view = ArrayBufferView::Cast(*value);
+    length = (int)TypedArray::Cast(*value)->Length();
+    return (char*)view->Buffer()->GetContents().Data() + view->ByteOffset();
+  }
+
+  void NeuralNetwork::PredictCacheSize(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: int capacity
+    if (args[0]->IsUndefined() || !args[0]->IsNumber())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be a number.")
+      ));
+      return;
+    }
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    int capacity = (int)args[0]->NumberValue();
+    if (capacity > 0) nn->cache.reset(new PredictionCache(capacity, nn->numInput, nn->numOutput));
+    else nn->cache.reset();
+  }
+
+  void NeuralNetwork::CacheStats(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    if (!nn->cache)
+    {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, (double)nn->cache->hits()));
+    result->Set(String::NewFromUtf8(isolate, "misses"), Number::New(isolate, (double)nn->cache->misses()));
+    result->Set(String::NewFromUtf8(isolate, "size"), Number::New(isolate, nn->cache->size()));
+    result->Set(String::NewFromUtf8(isolate, "capacity"), Number::New(isolate, nn->cache->capacity()));
+    args.GetReturnValue().Set(result);
+  }
+
+  void NeuralNetwork::PredictBatch(const PredictInput& input, double* probs, int* labels)
+  {
+    int widest = *std::max_element(topology.begin(), topology.end());
+    int blocks = (input.rows + PREDICT_BLOCK - 1) / PREDICT_BLOCK;
+    int workers = pool && blocks > 1 ? pool->size() : 1;
+
+    auto task = [&](int worker)
+    {
+      // Each worker ping-pongs a block of activations between two buffers.
+      std::vector<double> a((size_t)PREDICT_BLOCK * widest);
+      std::vector<double> b((size_t)PREDICT_BLOCK * widest);
+      std::vector<double> result(numOutput);
+      // The quantized and sparse paths go a sample at a time.
+      bool single = !quantized.empty() || sparse;
+      std::vector<double> qa(single ? widest : 0);
+      std::vector<double> qb(single ? widest : 0);
+      std::vector<int8_t> scratch(quantized.empty() ? 0 : quantizedScratch.size());
+      // Rows of the block not found in the cache, and their inputs.
+      std::vector<int> rows(PREDICT_BLOCK);
+      std::vector<double> keep(cache ? (size_t)PREDICT_BLOCK * numInput : 0);
+      for (int block = worker; block < blocks; block += workers)
+      {
+        int first = block * PREDICT_BLOCK;
+        int count = std::min(PREDICT_BLOCK, input.rows - first);
+
+        // Gather the block's inputs as contiguous doubles, leaving out
+        // rows answered by the cache.
+        double* x = a.data();
+        double* y = b.data();
+        int missing = 0;
+        for (int r = 0; r < count; r++)
+        {
+          size_t row = (size_t)(first + r);
+          double* dst = x + missing * numInput;
+          CopyRow(input, first + r, numInput, dst);
+
+          double* out = probs ? probs + row * numOutput : result.data();
+          if (cache && cache->find(dst, out))
+          {
+            if (labels) labels[row] = (int)(std::max_element(out, out + numOutput) - out);
+            continue;
+          }
+          rows[missing++] = (int)row;
+        }
+        // Keep the inputs for the cache; the block forward overwrites x.
+        if (cache) std::copy(x, x + missing * numInput, keep.begin());
+
+        if (!single)
+        {
+          for (int l = 0; l < layers.size(); l++)
+          {
+            layers[l].forwardBatch(x, missing, y);
+            std::swap(x, y);
+          }
+        }
+
+        for (int r = 0; r < missing; r++)
+        {
+          size_t row = (size_t)rows[r];
+          double* out = probs ? probs + row * numOutput : result.data();
+          const double* sums;
+          if (!quantized.empty()) sums = QuantizedForward(x + r * numInput, qa.data(), qb.data(), scratch.data());
+          else if (sparse) sums = SparseForward(x + r * numInput, qa.data(), qb.data());
+          else sums = x + r * numOutput;
+          Softmax(sums, numOutput, out);
+          if (cache) cache->insert(keep.data() + r * numInput, out);
+          if (labels) labels[row] = (int)(std::max_element(out, out + numOutput) - out);
+        }
+      }
+    };
+
+    if (workers > 1) pool->run(task);
+    else task(0);
+  }
+
+  void NeuralNetwork::Quantize(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    // Get arguments: calibration DataClass.
+    if (!args[0]->IsObject() || args[0]->ToObject()->InternalFieldCount() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be a DataClass.")
+      ));
+      return;
+    }
+    Matrix<double>& data = ObjectWrap::Unwrap<DataClass>(args[0]->ToObject())->data;
+    if (data.rows() < 1 || data.cols() != nn->numInput + nn->numOutput)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Calibration data must hold inputs and targets.")
+      ));
+      return;
+    }
+
+    // Find the largest magnitude reaching each layer with the float model.
+    nn->quantized.clear();
+    if (nn->cache) nn->cache->clear();
+    std::vector<double> ranges(nn->layers.size());
+    for (int i = 0; i < data.rows(); i++)
+    {
+      nn->inputs.assign(data[i].begin(), data[i].begin() + nn->numInput);
+      nn->Forward();
+      for (int l = 0; l < nn->layers.size(); l++)
+      {
+        const std::vector<double>& x = l == 0 ? nn->inputs : nn->layers[l - 1].values;
+        for (double v : x) ranges[l] = std::max(ranges[l], fabs(v));
+      }
+    }
+    double floatAccuracy = nn->AccuracyHelper(data);
+
+    size_t floatBytes = 0;
+    size_t quantizedBytes = 0;
+    int stride = 0;
+    for (int l = 0; l < nn->layers.size(); l++)
+    {
+      nn->quantized.push_back(QuantizedLayer(nn->layers[l], ranges[l]));
+      floatBytes += nn->layers[l].params.size() * sizeof(double);
+      quantizedBytes += nn->quantized[l].bytes();
+      stride = std::max(stride, nn->quantized[l].stride);
+    }
+    nn->quantizedScratch = std::vector<int8_t>(stride);
+
+    // Score the calibration data again through the int8 path.
+    PredictInput input;
+    input.matrix = &data;
+    input.rows = data.rows();
+    std::vector<int> labels(input.rows);
+    nn->PredictBatch(input, nullptr, labels.data());
+    int numCorrect = 0;
+    for (int i = 0; i < input.rows; i++)
+    {
+      std::vector<double> tValues(data[i].begin() + nn->numInput, data[i].end());
+      if (labels[i] == MaxIndex(tValues)) numCorrect++;
+    }
+
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "floatAccuracy"), Number::New(isolate, floatAccuracy));
+    result->Set(String::NewFromUtf8(isolate, "quantizedAccuracy"), Number::New(isolate, numCorrect * 1.0 / input.rows));
+    result->Set(String::NewFromUtf8(isolate, "floatBytes"), Number::New(isolate, (double)floatBytes));
+    result->Set(String::NewFromUtf8(isolate, "quantizedBytes"), Number::New(isolate, (double)quantizedBytes));
+    result->Set(String::NewFromUtf8(isolate, "kernel"), String::NewFromUtf8(isolate, QuantizedLayer::kernel()));
+    args.GetReturnValue().Set(result);
+  }
+
+  std::shared_ptr<const Model> NeuralNetwork::Snapshot()
+  {
+    return std::make_shared<Model>(layers);
+  }
+
+  void NeuralNetwork::Publish()
+  {
+    if (models) models->publish(Snapshot());
+    // The topology cannot change, so this only fails if something is
+    // badly wrong; readers then keep the last good generation.
+    std::string error;
+    if (shared) shared->publish(layers, error);
+  }
+
+  void NeuralNetwork::PublishShared(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    // Get arguments: name of the segment.
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
+      ));
+      return;
+    }
+    std::string name(*String::Utf8Value(args[0]));
+
+    std::string error;
+    bool ok;
+    if (nn->shared && (nn->shared->name() == name || nn->shared->name() == "/" + name))
+    {
+      ok = nn->shared->publish(nn->layers, error);
+    }
+    else
+    {
+      nn->shared.reset();
+      nn->shared = SharedModel::create(name, nn->layers, error);
+      ok = nn->shared != nullptr;
+    }
+    if (!ok)
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+      return;
+    }
+    args.GetReturnValue().Set(Number::New(isolate, (double)nn->shared->generation()));
+  }
+
+  void NeuralNetwork::AttachShared(const FunctionCallbackInfo<Value>& args)
+  {
+    SharedNetwork::Attach(args);
+  }
+
+  const double* NeuralNetwork::QuantizedForward(const double* x, double* a, double* b, int8_t* scratch)
+  {
+    const double* in = x;
+    double* out = a;
+    for (int l = 0; l < quantized.size(); l++)
+    {
+      quantized[l].forward(in, out, scratch);
+      in = out;
+      out = out == a ? b : a;
+    }
+    return in;
+  }
+
+  const double* NeuralNetwork::SparseForward(const double* x, double* a, double* b)
+  {
+    const double* in = x;
+    double* out = a;
+    for (int l = 0; l < layers.size(); l++)
+    {
+      layers[l].forwardSparse(in, out);
+      in = out;
+      out = out == a ? b : a;
+    }
+    return in;
+  }
+
+  void NeuralNetwork::Prune(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: options object.
+    if (!args[0]->IsObject())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be an options object.")
+      ));
+      return;
+    }
+    Local<Object> options = args[0]->ToObject();
+    Local<Value> value = options->Get(String::NewFromUtf8(isolate, "sparsity"));
+    if (!value->IsNumber() || value->NumberValue() < 0 || value->NumberValue() > 1)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "sparsity must be a number between 0 and 1.")
+      ));
+      return;
+    }
+    double sparsity = value->NumberValue();
+    int finetuneEpochs = 0;
+    value = options->Get(String::NewFromUtf8(isolate, "finetuneEpochs"));
+    if (value->IsNumber()) finetuneEpochs = (int)value->NumberValue();
+    double learnRate = 0.01;
+    value = options->Get(String::NewFromUtf8(isolate, "learnRate"));
+    if (value->IsNumber()) learnRate = value->NumberValue();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    DataClass* train = nullptr;
+    value = options->Get(String::NewFromUtf8(isolate, "train"));
+    if (value->IsObject() && value->ToObject()->InternalFieldCount() > 0)
+    {
+      train = ObjectWrap::Unwrap<DataClass>(value->ToObject());
+    }
+    if (finetuneEpochs > 0 && (!train || train->data.cols() != nn->numInput + nn->numOutput))
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "finetuneEpochs requires a train DataClass of inputs and targets.")
+      ));
+      return;
+    }
+    if (finetuneEpochs > 0 && asyncRuns > 0)
+    {
+      // Fine-tuning shuffles with the generator in use.
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
+    }
+
+    nn->quantized.clear();
+    if (nn->cache) nn->cache->clear();
+
+    for (int l = 0; l < nn->layers.size(); l++) nn->layers[l].prune(sparsity);
+
+    // Retrain the remaining weights; the masks keep the rest at zero.
+    std::vector<double> xValues = std::vector<double>(nn->numInput);
+    std::vector<double> tValues = std::vector<double>(nn->numOutput);
+    std::vector<int> sequence = std::vector<int>(train ? train->data.rows() : 0);
+    for (int i = 0; i < sequence.size(); i++) sequence[i] = i;
+    for (int epoch = 0; epoch < finetuneEpochs; epoch++)
+    {
+      Shuffle(sequence);
+      for (int idx : sequence)
+      {
+        xValues.assign(train->data[idx].begin(), train->data[idx].begin() + nn->numInput);
+        tValues.assign(train->data[idx].begin() + nn->numInput, train->data[idx].end());
+        nn->ComputeOutputs(xValues);
+        nn->UpdateWeights(tValues, learnRate);
+      }
+    }
+
+    int total = 0;
+    int nonZero = 0;
+    for (int l = 0; l < nn->layers.size(); l++)
+    {
+      nn->layers[l].compress();
+      total += nn->layers[l].inputs * nn->layers[l].outputs;
+      nonZero += (int)nn->layers[l].sparseWeights.size();
+    }
+    nn->sparse = true;
+    nn->Publish();
+
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "weights"), Number::New(isolate, total));
+    result->Set(String::NewFromUtf8(isolate, "nonZero"), Number::New(isolate, nonZero));
+    args.GetReturnValue().Set(result);
+  }
+
+  void NeuralNetwork::MomentumAndDecay(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: double momentum, double weightDecay
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Too few arguments.")
+      ));
+      return;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+      if (!args[i]->IsNumber())
+      {
+        std::string msg = "Argument " + std::to_string(i) + " must be a number.";
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, msg.c_str())
+        ));
+        return;
+      }
+    }
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    nn->momentum = args[0]->NumberValue();
+    nn->weightDecay = args[1]->NumberValue();
+  }
+
+  void NeuralNetwork::Threads(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: int count
+    if (args[0]->IsUndefined() || !args[0]->IsNumber())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be a number.")
+      ));
+      return;
+    }
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    nn->SetThreads((int)args[0]->NumberValue());
+    args.GetReturnValue().Set(nn->pool ? nn->pool->size() : 1);
+  }
+
+  void NeuralNetwork::SampledSoftmax(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Get arguments: int numSampled
+    if (args[0]->IsUndefined() || !args[0]->IsNumber())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Argument 0 must be a number.")
+      ));
+      return;
+    }
+
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    int count = (int)args[0]->NumberValue();
+    nn->numSampled = count < 0 ? 0 : count;
+  }
+
+  void NeuralNetwork::TrainingAccuracy(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    args.GetReturnValue().Set(DoubleVectorToJSArray(isolate, nn->trainingAccuracy));
+  }
+
+  void NeuralNetwork::TestingAccuracy(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    args.GetReturnValue().Set(DoubleVectorToJSArray(isolate, nn->testingAccuracy));
+  }
+
+  void NeuralNetwork::ExportCpp(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    // Get arguments: path, and optionally an options object.
+    if (args[0]->IsUndefined() || !args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
+      ));
+      return;
+    }
+    std::string path(*String::Utf8Value(args[0]));
+    std::string space = "model";
+    int precision = 17;
+    if (args.Length() > 1 && args[1]->IsObject())
+    {
+      Local<Object> options = args[1]->ToObject();
+      Local<Value> value = options->Get(String::NewFromUtf8(isolate, "namespace"));
+      if (value->IsString()) space = std::string(*String::Utf8Value(value));
+      value = options->Get(String::NewFromUtf8(isolate, "precision"));
+      if (value->IsNumber()) precision = (int)value->NumberValue();
+    }
+
+    // The namespace must be a valid identifier.
+    bool valid = !space.empty() && !isdigit((unsigned char)space[0]);
+    for (char c : space) valid = valid && (isalnum((unsigned char)c) || c == '_');
+    if (!valid)
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "namespace must be a C++ identifier.")
+      ));
+      return;
+    }
+    if (precision < 1) precision = 1;
+    if (precision > 17) precision = 17;
+
+    // Replace the file in one step, so a failed export leaves no half
+    // written header behind.
+    std::string source = nn->CppSource(space, precision);
+    std::string error;
+    if (!tools::writeFile(path, source.data(), source.size(), error))
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+    }
+  }
+
+  void NeuralNetwork::Serve(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+
+    // Get arguments: options object.
+    ServerOptions options;
+    if (args.Length() > 0 && args[0]->IsObject())
+    {
+      Local<Object> object = args[0]->ToObject();
+      Local<Value> value = object->Get(String::NewFromUtf8(isolate, "socket"));
+      if (value->IsString()) options.socketPath = std::string(*String::Utf8Value(value));
+      value = object->Get(String::NewFromUtf8(isolate, "port"));
+      if (value->IsNumber()) options.port = (int)value->NumberValue();
+      value = object->Get(String::NewFromUtf8(isolate, "maxBatch"));
+      if (value->IsNumber()) options.maxBatch = (int)value->NumberValue();
+      value = object->Get(String::NewFromUtf8(isolate, "maxWaitMicros"));
+      if (value->IsNumber()) options.maxWaitMicros = (int)value->NumberValue();
+      value = object->Get(String::NewFromUtf8(isolate, "workers"));
+      if (value->IsNumber()) options.workers = (int)value->NumberValue();
+    }
+
+    // Replace any running server.
+    nn->server.reset();
+    if (!nn->models) nn->models = std::make_shared<ModelHandle>(nn->Snapshot());
+    else nn->Publish();
+    std::unique_ptr<InferenceServer> server(new InferenceServer(nn->models, options));
+    std::string error;
+    if (!server->start(error))
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+      return;
+    }
+    args.GetReturnValue().Set(server->port());
+    nn->server = std::move(server);
   }
 
-  void NeuralNetwork::MomentumAndDecay(const FunctionCallbackInfo<Value>& args)
+  void NeuralNetwork::ServerStats(const FunctionCallbackInfo<Value>& args)
   {
     Isolate* isolate = args.GetIsolate();
-
-    // Get arguments: double momentum, double weightDecay
-    if (args.Length() < 2)
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (!nn->server)
     {
-      isolate->ThrowException(Exception::TypeError(
-        String::NewFromUtf8(isolate, "Too few arguments.")
-      ));
+      args.GetReturnValue().SetNull();
       return;
     }
-    for (int i = 0; i < 2; i++)
+
+    ANN::ServerStats stats = nn->server->stats();
+    Local<Object> result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "requests"), Number::New(isolate, (double)stats.requests));
+    result->Set(String::NewFromUtf8(isolate, "rows"), Number::New(isolate, (double)stats.rows));
+    result->Set(String::NewFromUtf8(isolate, "batches"), Number::New(isolate, (double)stats.batches));
+    result->Set(String::NewFromUtf8(isolate, "errors"), Number::New(isolate, (double)stats.errors));
+    result->Set(String::NewFromUtf8(isolate, "queueDepth"), Number::New(isolate, stats.queueDepth));
+    // latency[b] counts requests answered in under 2^b microseconds.
+    Local<Array> latency = Array::New(isolate, (int)stats.latency.size());
+    for (int b = 0; b < stats.latency.size(); b++)
     {
-      if (!args[i]->IsNumber())
-      {
-        std::string msg = "Argument " + std::to_string(i) + " must be a number.";
-        isolate->ThrowException(Exception::TypeError(
-          String::NewFromUtf8(isolate, msg.c_str())
-        ));
-        return;
-      }
+      latency->Set(b, Number::New(isolate, (double)stats.latency[b]));
     }
+    result->Set(String::NewFromUtf8(isolate, "latency"), latency);
+    args.GetReturnValue().Set(result);
+  }
 
+  void NeuralNetwork::StopServer(const FunctionCallbackInfo<Value>& args)
+  {
     // Unwrap NeuralNetwork.
     NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
-    nn->momentum = args[0]->NumberValue();
-    nn->weightDecay = args[1]->NumberValue();
+    nn->server.reset();
   }
 
-  void NeuralNetwork::TrainingAccuracy(const FunctionCallbackInfo<Value>& args)
+  void NeuralNetwork::BlasBackend(const FunctionCallbackInfo<Value>& args)
   {
     Isolate* isolate = args.GetIsolate();
-    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
-    args.GetReturnValue().Set(DoubleVectorToJSArray(isolate, nn->trainingAccuracy));
+    args.GetReturnValue().Set(String::NewFromUtf8(isolate, blas::active().name.c_str()));
   }
 
-  void NeuralNetwork::TestingAccuracy(const FunctionCallbackInfo<Value>& args)
+  void NeuralNetwork::LoadBlas(const FunctionCallbackInfo<Value>& args)
   {
     Isolate* isolate = args.GetIsolate();
-    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
-    args.GetReturnValue().Set(DoubleVectorToJSArray(isolate, nn->testingAccuracy));
+    if (asyncRuns > 0)
+    {
+      // The worker is calling into the current backend.
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
+    }
+
+    // No arguments reverts to the backend chosen at build time.
+    if (args.Length() == 0)
+    {
+      blas::reset();
+      args.GetReturnValue().Set(true);
+      return;
+    }
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Path to a CBLAS library required.")));
+      return;
+    }
+
+    std::string path(*String::Utf8Value(args[0]));
+    args.GetReturnValue().Set(blas::load(path));
   }
 
   void NeuralNetwork::Save(const FunctionCallbackInfo<Value>& args)
@@ -531,10 +2016,12 @@ namespace ANN
     Isolate* isolate = args.GetIsolate();
     // Unwrap NeuralNetwork.
     NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
     // Get arguments:
     //   path       the path to the file to write information to
     //   verbose    whether or not to write a verbose set of information
-    //   precision  the number of decimal places to show
+    //   precision  the number of decimal places to show, or 'shortest' for
+    //              each weight exactly in as few digits as possible
     if (args[0]->IsUndefined() || !args[0]->IsString())
     {
       isolate->ThrowException(Exception::TypeError(
@@ -554,88 +2041,205 @@ namespace ANN
     {
       precision = (int)args[2]->NumberValue();
     }
-    if (verbose) padding = precision + 3;
+    else if (args[2]->IsString() && std::string(*String::Utf8Value(args[2])) == "shortest")
+    {
+      precision = tools::SHORTEST;
+    }
+    // Room for the sign, the integer digit and the point, or for the
+    // longest shortest form (e.g. -1.2345678901234567e-100).
+    if (verbose) padding = precision == tools::SHORTEST ? 24 : precision + 3;
 
-    // Open file for writing, truncating it if it already exists.
-    std::ofstream file(path, std::fstream::out | std::fstream::trunc);
-    std::string line = "";
+    // Open file for writing, truncating it if it already exists. The
+    // weights are formatted into the writer's buffer and written out as
+    // it fills.
+    TextWriter file(path);
 
     // Write setup information.
     if (verbose)
     {
-      file << "Input Nodes : " << nn->numInput << "\n";
-      file << "Hidden Nodes: " << nn->numHidden << "\n";
-      file << "Output Nodes: " << nn->numOutput << "\n";
+      file.write("Input Nodes : ");
+      file.writeInt(nn->numInput);
+      file.write('\n');
+      for (int l = 1; l < nn->topology.size() - 1; l++)
+      {
+        file.write("Hidden Nodes: ");
+        file.writeInt(nn->topology[l]);
+        file.write('\n');
+      }
+      file.write("Output Nodes: ");
+      file.writeInt(nn->numOutput);
+      file.write('\n');
     }
     else
     {
-      file << nn->numInput << " " << nn->numHidden << " " << nn->numOutput << "\n";
+      for (int l = 0; l < nn->topology.size(); l++)
+      {
+        if (l > 0) file.write(' ');
+        file.writeInt(nn->topology[l]);
+      }
+      file.write('\n');
+    }
+
+    // Write each layer's weights then biases.
+    for (int l = 0; l < nn->layers.size(); l++)
+    {
+      Layer& layer = nn->layers[l];
+      bool first = l == 0;
+      bool last = l == nn->layers.size() - 1;
+      if (verbose)
+      {
+        file.write(std::string(first ? "Input" : "Hidden") + "/" + (last ? "Output" : "Hidden") + " Weights:\n");
+      }
+      WriteBlock(file, layer.weights(), layer.inputs, layer.outputs, precision, verbose, padding);
+      if (verbose) file.write(std::string(last ? "Output" : "Hidden") + " Layer Biases:\n");
+      file.writeRow(layer.biases(), layer.outputs, precision, verbose, padding);
+      file.write('\n');
+    }
+
+    // Write out what is left and close the file.
+    file.flush();
+    if (!file.good())
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, ("Cannot write " + path + ".").c_str())
+      ));
+    }
+  }
+
+  void NeuralNetwork::SaveBinary(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap NeuralNetwork.
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(args.Holder());
+    if (Busy(isolate, nn)) return;
+    // Get arguments: path.
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
+      ));
+      return;
+    }
+    std::string path(*String::Utf8Value(args[0]));
+
+    std::string error;
+    if (!ModelFile::write(path, nn->layers, error))
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+    }
+  }
+
+  void NeuralNetwork::Load(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Get arguments: path.
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "First argument must be a defined string.")
+      ));
+      return;
     }
+    std::string path(*String::Utf8Value(args[0]));
 
-    // Write hidden layer.
-    if (verbose) file << "Input/Hidden Weights:\n";
-    file << nn->ihWeights.toString(precision, verbose, padding);
-    if (verbose) file << "Hidden Layer Biases:\n";
-    file << VectorToString(nn->hBiases, precision, verbose, padding) << "\n";
+    // Binary files are mapped and their blocks copied once; text files
+    // are parsed.
+    std::string error;
+    std::shared_ptr<const ModelFile> file;
+    std::vector<int> topology;
+    std::vector<double> weights;
+    if (ModelFile::detect(path))
+    {
+      file = ModelFile::open(path, error);
+      if (file) topology = file->topology();
+    }
+    else if (!ReadSaved(path, topology, weights, error))
+    {
+      topology.clear();
+    }
+    if (topology.empty())
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, error.c_str())
+      ));
+      return;
+    }
 
-    // Write output layer.
-    if (verbose) file << "Hidden/Output Weights:\n";
-    file << nn->hoWeights.toString(precision, verbose, padding);
-    if (verbose) file << "Output Layer Biases:\n";
-    file << VectorToString(nn->oBiases, precision, verbose, padding) << "\n";
+    if (asyncRuns > 0)
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Another network is training.")
+      ));
+      return;
+    }
 
-    // Close the file.
-    file.close();
+    // Construct the network as new NeuralNetwork(topology) would.
+    Local<Array> sizes = Array::New(isolate, (int)topology.size());
+    for (int l = 0; l < topology.size(); l++)
+    {
+      sizes->Set(l, Number::New(isolate, topology[l]));
+    }
+    const int argc = 1;
+    Local<Value> argv[argc] = { sizes };
+    Local<Context> context = isolate->GetCurrentContext();
+    Local<Function> construct = Local<Function>::New(isolate, constructor);
+    Local<Object> result = construct->NewInstance(context, argc, argv).ToLocalChecked();
+    NeuralNetwork* nn = ObjectWrap::Unwrap<NeuralNetwork>(result);
+
+    if (file)
+    {
+      for (int l = 0; l < nn->layers.size(); l++)
+      {
+        Layer& layer = nn->layers[l];
+        layer.activation = file->activation(l);
+        std::copy(file->params(l), file->params(l) + layer.size(), layer.params.begin());
+      }
+    }
+    else nn->SetWeights(weights);
+    args.GetReturnValue().Set(result);
   }
 
   std::string NeuralNetwork::VectorToString(const std::vector<double>& v, int precision, bool verbose, int padding)
   {
-    std::string output = "";
-    for (int i = 0; i < v.size(); i++)
+    TextWriter output;
+    output.writeRow(v.data(), v.size(), precision, verbose, padding);
+    return output.str();
+  }
+
+  std::string NeuralNetwork::BlockToString(const double* v, int rows, int cols, int precision, bool verbose, int padding)
+  {
+    TextWriter output;
+    WriteBlock(output, v, rows, cols, precision, verbose, padding);
+    return output.str();
+  }
+
+  void NeuralNetwork::WriteBlock(TextWriter& out, const double* v, int rows, int cols, int precision, bool verbose, int padding)
+  {
+    for (int i = 0; i < rows; i++)
     {
-      if (i > 0) output += " ";
-      std::string item = tools::toString(v[i], precision);
-      if (padding > item.length()) item.insert(item.begin(), padding - item.length(), ' ');
-      output += item;
+      out.writeRow(v + (size_t)i * cols, cols, precision, verbose, padding);
+      out.write('\n');
     }
-    if (verbose) output = "[ " + output + " ]";
-    return output;
   }
 
   std::vector<double> NeuralNetwork::GetWeights()
   {
     // Returns the current set of weights, presumably after training.
-  	std::vector<double> result = std::vector<double>(NumWeights());
-  	int k = 0;
-  	for (int i = 0; i < ihWeights.rows(); i++)
-  	{
-  		for (int j = 0; j < ihWeights.cols(); j++)
-  		{
-  			result[k++] = ihWeights[i][j];
-  		}
-  	}
-  	for (int i = 0; i < hBiases.size(); i++)
-  	{
-  		result[k++] = hBiases[i];
-  	}
-  	for (int i = 0; i < hoWeights.rows(); i++)
-  	{
-  		for (int j = 0; j < hoWeights.cols(); j++)
-  		{
-  			result[k++] = hoWeights[i][j];
-  		}
-  	}
-  	for (int i = 0; i < oBiases.size(); i++)
+    // Each layer's slab already holds its weights then its biases.
+  	std::vector<double> result;
+  	result.reserve(NumWeights());
+  	for (Layer& layer : layers)
   	{
-  		result[k++] = oBiases[i];
+  		result.insert(result.end(), layer.params.begin(), layer.params.end());
   	}
   	return result;
   }
 
   void NeuralNetwork::SetWeights(std::vector<double>& weights)
   {
-    // Copy weights and biases in weights vector to i-h weights,
-  	// i-h biases, h-o weights, and h-o biases.
+    // Copy weights and biases in weights vector into each layer in turn.
   	if (weights.size() != NumWeights())
   	{
   		// ADD IN THROW EXCEPTION.
@@ -645,29 +2249,12 @@ namespace ANN
 
   	// Points into weights param.
   	int k = 0;
-
-  	for (int i = 0; i < numInput; i++)
-  	{
-  		for (int j = 0; j < numHidden; j++)
-  		{
-  			ihWeights[i][j] = weights[k++];
-  		}
-  	}
-  	for (int i = 0; i < numHidden; i++)
+  	for (Layer& layer : layers)
   	{
-  		hBiases[i] = weights[k++];
-  	}
-  	for (int i = 0; i < numHidden; i++)
-  	{
-  		for (int j = 0; j < numOutput; j++)
-  		{
-  			hoWeights[i][j] = weights[k++];
-  		}
-  	}
-  	for (int i = 0; i < numOutput; i++)
-  	{
-  		oBiases[i] = weights[k++];
+  		std::copy(weights.begin() + k, weights.begin() + k + layer.size(), layer.params.begin());
+  		k += layer.size();
   	}
+  	if (cache) cache->clear();
   }
 
   void NeuralNetwork::UpdateWeights(std::vector<double>& tValues, double learnRate)
@@ -684,6 +2271,7 @@ namespace ANN
   	}
 
   	// 1. Compute output gradients.
+  	std::vector<double>& oGrads = layers.back().grads;
   	for (int i = 0; i < oGrads.size(); i++)
   	{
   		// Derivative of softmax = (1 - y) * y (same as log-sigmoid).
@@ -692,75 +2280,49 @@ namespace ANN
   		oGrads[i] = derivative * (tValues[i] - outputs[i]);
   	}
 
-  	// 2. Compute hidden gradients.
-  	for (int i = 0; i < hGrads.size(); i++)
-  	{
-  		// Derivative of tanh = (1 - y) * (1 + y).
-  		double derivative = (1 - hOutputs[i]) * (1 + hOutputs[i]);
-  		double sum = 0.0;
-  		for (int j = 0; j < numOutput; j++)
-  		{
-  			double x = oGrads[j] * hoWeights[i][j];
-  			sum += x;
-  		}
-  		hGrads[i] = derivative * sum;
-  	}
+  	// 2. Compute hidden gradients, then 3. update the weights.
+  	Backward(learnRate);
+  }
+
+  void NeuralNetwork::Backward(double learnRate)
+  {
+  	const int* columns = sampledClasses.empty() ? nullptr : sampledClasses.data();
+  	int count = (int)sampledClasses.size();
+  	int last = (int)layers.size() - 1;
 
-  	// 3a. Update hidden weights (gradients must be computed right-to-left
-  	// but weights can be updated in any order).
-  	for (int i = 0; i < ihWeights.rows(); i++)
+  	auto task = [&](int worker)
   	{
-  		for (int j = 0; j < ihWeights.cols(); j++)
+  		int workers = Workers();
+  		int begin, end;
+
+  		// Gradients must be computed right-to-left, each layer handing
+  		// them to the nodes of the layer below.
+  		for (int l = last; l > 0; l--)
   		{
-  			// Compute the new delta.
-  			double delta = learnRate * hGrads[j] * inputs[i];
-  			// Update, note: we use '+' instead of '-'. This can be very
-  			// tricky. Now, add momentum using previous delta. On first
-  			// pass old value will be 0.0 but that is okay.
-  			ihWeights[i][j] += delta;
-  			if (momentum > 0) ihWeights[i][j] += momentum * ihPrevWeightsDelta[i][j];
-  			// Weight decay.
-  			if (weightDecay > 0) ihWeights[i][j] -= (weightDecay * ihWeights[i][j]);
-  			// Don't forget to save the delta for momentum.
-  			ihPrevWeightsDelta[i][j] = delta;
+  			Layer& layer = layers[l];
+  			Layer& prev = layers[l - 1];
+  			Range(layer.inputs, worker, workers, begin, end);
+  			layer.backward(prev.values.data(), prev.grads.data(), begin, end,
+  				l == last ? columns : nullptr, count);
+  			Sync();
   		}
-  	}
-
-  	// 3b. Update hidden biases.
-  	for (int i = 0; i < hBiases.size(); i++)
-  	{
-  		double delta = learnRate * hGrads[i] * 1.0;
-  		hBiases[i] += delta;
-  		if (momentum > 0) hBiases[i] += momentum * hPrevBiasesDelta[i];
-  		if (weightDecay > 0) hBiases[i] -= weightDecay * hBiases[i];
-  		// Don't forget to save the delta.
-  		hPrevBiasesDelta[i] = delta;
-  	}
 
-  	// 4a. Update hidden-output weights.
-  	for (int i = 0; i < hoWeights.rows(); i++)
-  	{
-  		for (int j = 0; j < hoWeights.cols(); j++)
+  		// Weights can be updated in any order once every gradient is
+  		// known. Each worker owns a band of rows (and biases).
+  		for (int l = 0; l <= last; l++)
   		{
-  			double delta = learnRate * oGrads[j] * hOutputs[i];
-  			hoWeights[i][j] += delta;
-  			if (momentum > 0) hoWeights[i][j] += momentum * hoPrevWeightsDelta[i][j];
-  			if (weightDecay > 0) hoWeights[i][j] -= weightDecay * hoWeights[i][j];
-  			// Save delta.
-  			hoPrevWeightsDelta[i][j] = delta;
+  			Layer& layer = layers[l];
+  			const int* cols = l == last ? columns : nullptr;
+  			const double* x = l == 0 ? inputs.data() : layers[l - 1].values.data();
+  			Range(layer.inputs, worker, workers, begin, end);
+  			layer.updateWeights(x, learnRate, momentum, weightDecay, begin, end, cols, count);
+  			Range(cols ? count : layer.outputs, worker, workers, begin, end);
+  			layer.updateBiases(learnRate, momentum, weightDecay, begin, end, cols);
   		}
-  	}
+  	};
 
-  	// 4b. Update output biases.
-  	for (int i = 0; i < oBiases.size(); i++)
-  	{
-  		double delta = learnRate * oGrads[i] * 1.0;
-  		oBiases[i] += delta;
-  		if (momentum > 0) oBiases[i] += momentum * oPrevBiasesDelta[i];
-  		if (weightDecay > 0) oBiases[i] -= weightDecay * oBiases[i];
-  		// Save delta.
-  		oPrevBiasesDelta[i] = delta;
-  	}
+  	if (pool) pool->run(task);
+  	else task(0);
   }
 
   std::vector<double> NeuralNetwork::ComputeOutputs(std::vector<double>& xValues)
@@ -772,64 +2334,181 @@ namespace ANN
   		return std::vector<double>();
   	}
 
-  	// Hidden nodes sums scratch array.
-  	std::vector<double> hSums = std::vector<double>(numHidden);
-  	// Output nodes sums.
-  	std::vector<double> oSums = std::vector<double>(numOutput);
-
-  	// Copy x-values to inputs.
-  	/*
-  	for (int i = 0; i < xValues.size(); i++)
-  	{
-  		inputs[i] = xValues[i];
-  	}
-  	*/
   	inputs.assign(xValues.begin(), xValues.end());
+  	Forward();
+
+  	// Softmax activation does all outputs at once for efficiency.
+  	Softmax(layers.back().values.data(), numOutput, outputs.data());
+
+  	// Could define a getOutputs method instead.
+  	std::vector<double> result = std::vector<double>(outputs);
+  	return result;
+  }
+
+  void NeuralNetwork::Forward()
+  {
+  	const int* columns = sampledClasses.empty() ? nullptr : sampledClasses.data();
+  	int count = (int)sampledClasses.size();
+  	int last = (int)layers.size() - 1;
 
-  	// Compute i-h sum of weights * inputs.
-  	for (int j = 0; j < numHidden; j++)
+  	auto task = [&](int worker)
   	{
-  		for (int i = 0; i < numInput; i++)
+  		int workers = Workers();
+  		int begin, end;
+  		const double* x = inputs.data();
+  		for (int l = 0; l <= last; l++)
   		{
-  			// Note: +=
-  			hSums[j] += inputs[i] * ihWeights[i][j];
+  			Layer& layer = layers[l];
+  			const int* cols = l == last ? columns : nullptr;
+  			if (!cols && SplitByOutputs(l))
+  			{
+  				// Wide layer: each worker computes a band of its nodes.
+  				Range(layer.outputs, worker, workers, begin, end);
+  				layer.forward(x, begin, end);
+  			}
+  			else
+  			{
+  				// Narrow (or sampled) layer: each worker sums a band of the
+  				// inputs, then one worker reduces the partial sums.
+  				Range(layer.inputs, worker, workers, begin, end);
+  				layer.forwardPartial(x, &partials[worker * partialStride], begin, end, cols, count);
+  				Sync();
+  				if (worker == 0) layer.reduce(partials.data(), workers, partialStride, cols, count);
+  			}
+  			if (l < last) Sync();
+  			x = layer.values.data();
   		}
-  	}
+  	};
+
+  	if (pool) pool->run(task);
+  	else task(0);
+  }
 
-  	// Add biases to input-to-hidden sums.
-  	for (int i = 0; i < numHidden; i++)
+  double NeuralNetwork::UpdateWeightsSampled(std::vector<double>& xValues, int target, double learnRate)
+  {
+  	if (xValues.size() != numInput)
   	{
-  		hSums[i] += hBiases[i];
+  		// THROW EXCEPTION.
+  		throw "";
+  		return 0.0;
   	}
 
-  	// Apply activation.
-  	for (int i = 0; i < numHidden; i++)
+  	// Pick the classes for this sample and compute their sums only.
+  	SampleClasses(target);
+  	int count = (int)sampledClasses.size();
+  	inputs.assign(xValues.begin(), xValues.end());
+  	Forward();
+
+  	// The negatives are drawn uniformly, so the log-probability
+  	// correction is the same for every class and cancels out of the
+  	// softmax. The sums and grads are packed in sampledClasses order.
+  	Layer& output = layers.back();
+  	Softmax(output.values.data(), count, outputs.data());
+
+  	// Cross entropy gradient over the sampled classes (target is first).
+  	for (int k = 0; k < count; k++)
   	{
-  		hOutputs[i] = HyperTanFunction(hSums[i]);
+  		double t = k == 0 ? 1.0 : 0.0;
+  		output.grads[k] = t - outputs[k];
   	}
+  	double p = outputs[0];
+
+  	Backward(learnRate);
+
+  	sampledClasses.clear();
+  	return -log(p > 1e-300 ? p : 1e-300);
+  }
 
-  	// Compute h-o sum of weights * hOutputs.
-  	for (int j = 0; j < numOutput; j++)
+  void NeuralNetwork::SampleClasses(int target)
+  {
+  	sampledClasses.clear();
+  	sampledClasses.push_back(target);
+
+  	// Sampling nearly every class costs more than using them all.
+  	if (numSampled >= numOutput - 1)
   	{
-  		for (int i = 0; i < numHidden; i++)
+  		for (int c = 0; c < numOutput; c++)
   		{
-  			oSums[j] += hOutputs[i] * hoWeights[i][j];
+  			if (c != target) sampledClasses.push_back(c);
   		}
+  		return;
   	}
 
-  	// Add biases to input-to-hidden sums.
-  	for (int i = 0; i < numOutput; i++)
+  	// Draw distinct negatives uniformly. A fresh stamp value marks the
+  	// classes drawn for this sample without clearing the array.
+  	if (++stamp == 0)
+  	{
+  		std::fill(sampledStamp.begin(), sampledStamp.end(), 0);
+  		stamp = 1;
+  	}
+  	sampledStamp[target] = stamp;
+  	while ((int)sampledClasses.size() <= numSampled)
   	{
-  		oSums[i] += oBiases[i];
+  		int c = (int)(random.nextDouble() * numOutput);
+  		if (c >= numOutput || sampledStamp[c] == stamp) continue;
+  		sampledStamp[c] = stamp;
+  		sampledClasses.push_back(c);
   	}
+  }
 
-  	// Softmax activation does all outputs at once for efficiency.
-  	std::vector<double> softOut = Softmax(oSums);
-  	outputs = std::vector<double>(softOut);
+  void NeuralNetwork::SetThreads(int count)
+  {
+    // Widest hidden layer (or the output layer when there is none).
+    int widest = 0;
+    for (int l = 1; l < topology.size(); l++)
+    {
+      if (l < topology.size() - 1 || topology.size() == 2)
+      {
+        if (topology[l] > widest) widest = topology[l];
+      }
+    }
 
-  	// Could define a getOutputs method instead.
-  	std::vector<double> result = std::vector<double>(outputs);
-  	return result;
+    if (count <= 0)
+    {
+      // Only go parallel when the network is wide enough to pay for the
+      // synchronisation.
+      count = 1;
+      if (NumWeights() >= PARALLEL_THRESHOLD)
+      {
+        count = (int)std::thread::hardware_concurrency();
+        if (count > widest / PARALLEL_MIN_HIDDEN) count = widest / PARALLEL_MIN_HIDDEN;
+      }
+    }
+    if (count > widest) count = widest;
+    if (count < 1) count = 1;
+
+    if (count == 1) pool.reset();
+    else if (!pool || pool->size() != count) pool.reset(new ThreadPool(count));
+
+    // Room for a partial sum per output node of the widest layer.
+    partialStride = 0;
+    for (Layer& layer : layers)
+    {
+      if (layer.outputs > partialStride) partialStride = layer.outputs;
+    }
+    partials = std::vector<double>(count * partialStride);
+  }
+
+  int NeuralNetwork::Workers()
+  {
+    return pool ? pool->size() : 1;
+  }
+
+  bool NeuralNetwork::SplitByOutputs(int l)
+  {
+    int workers = Workers();
+    return workers == 1 || layers[l].outputs >= workers * PARALLEL_MIN_HIDDEN;
+  }
+
+  void NeuralNetwork::Sync()
+  {
+    if (pool) pool->barrier().wait();
+  }
+
+  void NeuralNetwork::Range(int count, int worker, int workers, int& begin, int& end)
+  {
+    begin = (int)((long long)count * worker / workers);
+    end = (int)((long long)count * (worker + 1) / workers);
   }
 
   double NeuralNetwork::MeanSquaredError(Matrix<double>& trainData)
@@ -859,13 +2538,6 @@ namespace ANN
   	return sumSquaredError / trainData.rows();
   }
 
-  double NeuralNetwork::HyperTanFunction(double x)
-  {
-    if (x < -20.0) return -1.0;
-    else if (x > 20.0) return 1.0;
-    else return tanh(x);
-  }
-
   std::vector<double> NeuralNetwork::Softmax(std::vector<double>& oSums)
   {
     // Determine max output sum.
@@ -894,6 +2566,28 @@ namespace ANN
 		return result;
   }
 
+  void NeuralNetwork::Softmax(const double* oSums, int count, double* result)
+  {
+    // Same as above, without allocating.
+    double max = oSums[0];
+    for (int i = 0; i < count; i++)
+    {
+      if (oSums[i] > max) max = oSums[i];
+    }
+
+    double scale = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+      result[i] = exp(oSums[i] - max);
+      scale += result[i];
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      result[i] /= scale;
+    }
+  }
+
   void NeuralNetwork::Shuffle(std::vector<int>& sequence)
   {
     for (int i = 0; i < sequence.size(); i++)
@@ -920,9 +2614,120 @@ namespace ANN
     return index;
   }
 
+  std::string NeuralNetwork::CppSource(const std::string& space, int precision)
+  {
+    auto number = [precision](double value)
+    {
+      // printf spells these nan and inf, which do not compile.
+      if (value != value) return std::string("std::numeric_limits<double>::quiet_NaN()");
+      if (value == INFINITY) return std::string("std::numeric_limits<double>::infinity()");
+      if (value == -INFINITY) return std::string("-std::numeric_limits<double>::infinity()");
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+      return std::string(buffer);
+    };
+    auto index = [](const std::string& name, int i)
+    {
+      return name + "[" + std::to_string(i) + "]";
+    };
+
+    std::string guard = space;
+    for (char& c : guard) c = (char)toupper((unsigned char)c);
+    guard += "_MODEL_HH";
+
+    std::string topo;
+    for (int n : topology) topo += " " + std::to_string(n);
+
+    std::string s = "";
+    s += "// Generated by NeuralNetwork.exportCpp(). Topology:" + topo + ".\n";
+    s += "#ifndef " + guard + "\n";
+    s += "#define " + guard + "\n\n";
+    s += "#include <limits>\n";
+    s += "#include <math.h>\n\n";
+    s += "namespace " + space + "\n{\n";
+    s += "  constexpr int numInput = " + std::to_string(numInput) + ";\n";
+    s += "  constexpr int numOutput = " + std::to_string(numOutput) + ";\n\n";
+
+    // Weights (inputs x outputs, row-major) and biases of each layer.
+    for (int l = 0; l < layers.size(); l++)
+    {
+      Layer& layer = layers[l];
+      std::string name = "layer" + std::to_string(l + 1);
+      s += "  constexpr double " + name + "Weights[" + std::to_string(layer.inputs * layer.outputs) + "] = {";
+      for (int i = 0; i < layer.inputs * layer.outputs; i++)
+      {
+        s += (i % layer.outputs == 0 ? "\n    " : " ") + number(layer.weights()[i]) + ",";
+      }
+      s += "\n  };\n";
+      s += "  constexpr double " + name + "Biases[" + std::to_string(layer.outputs) + "] = {\n   ";
+      for (int j = 0; j < layer.outputs; j++) s += " " + number(layer.biases()[j]) + ",";
+      s += "\n  };\n\n";
+    }
+
+    s += "  inline double activate(double x)\n  {\n";
+    s += "    if (x < -20.0) return -1.0;\n";
+    s += "    else if (x > 20.0) return 1.0;\n";
+    s += "    else return tanh(x);\n  }\n\n";
+
+    // The forward pass sums each node in the same order as the network
+    // so that the results match it.
+    s += "  // Writes the class probabilities of the numInput values in x to y.\n";
+    s += "  inline void predict(const double* x, double* y)\n  {\n";
+    std::string in = "x";
+    for (int l = 0; l < layers.size(); l++)
+    {
+      Layer& layer = layers[l];
+      bool last = l == layers.size() - 1;
+      std::string name = "layer" + std::to_string(l + 1);
+      std::string out = last ? "sums" : "h" + std::to_string(l + 1);
+      s += "    double " + out + "[" + std::to_string(layer.outputs) + "];\n";
+      std::string open = last ? "" : "activate(";
+      std::string close = last ? "" : ")";
+      if (layer.inputs * layer.outputs <= EXPORT_UNROLL_LIMIT)
+      {
+        for (int j = 0; j < layer.outputs; j++)
+        {
+          std::string sum;
+          for (int i = 0; i < layer.inputs; i++)
+          {
+            if (i > 0) sum += " + ";
+            sum += index(in, i) + " * " + number(layer.weights()[i * layer.outputs + j]);
+          }
+          s += "    " + index(out, j) + " = " + open + "(" + sum + ") + " + number(layer.biases()[j]) + close + ";\n";
+        }
+      }
+      else
+      {
+        std::string inputs = std::to_string(layer.inputs);
+        std::string outputs = std::to_string(layer.outputs);
+        s += "    for (int j = 0; j < " + outputs + "; j++) " + out + "[j] = 0.0;\n";
+        s += "    for (int i = 0; i < " + inputs + "; i++)\n    {\n";
+        s += "      for (int j = 0; j < " + outputs + "; j++) " + out + "[j] += " + in + "[i] * " + name + "Weights[i * " + outputs + " + j];\n";
+        s += "    }\n";
+        s += "    for (int j = 0; j < " + outputs + "; j++) " + out + "[j] = " + open + out + "[j] + " + name + "Biases[j]" + close + ";\n";
+      }
+      s += "\n";
+      in = out;
+    }
+
+    // Softmax.
+    s += "    double max = sums[0];\n";
+    s += "    for (int i = 0; i < numOutput; i++) if (sums[i] > max) max = sums[i];\n";
+    s += "    double scale = 0.0;\n";
+    s += "    for (int i = 0; i < numOutput; i++)\n    {\n";
+    s += "      y[i] = exp(sums[i] - max);\n";
+    s += "      scale += y[i];\n    }\n";
+    s += "    for (int i = 0; i < numOutput; i++) y[i] /= scale;\n";
+    s += "  }\n}\n\n";
+    s += "#endif\n";
+    return s;
+  }
+
   int NeuralNetwork::NumWeights()
   {
-    return (numInput * numHidden) + (numHidden * numOutput) + numHidden + numOutput;
+    int count = 0;
+    for (Layer& layer : layers) count += layer.size();
+    return count;
   }
 
   Local<Array> NeuralNetwork::DoubleVectorToJSArray(Isolate* isolate, std::vector<double>& v)
@@ -1,13 +1,19 @@
 #include <node.h>
 #include "data-class.hh"
+#include "ensemble.hh"
+#include "model-registry.hh"
 #include "neural-network.hh"
+#include "shared-network.hh"
 
 namespace ANN
 {
 	void init(v8::Local<v8::Object> exports)
 	{
 		DataClass::Init(exports);
+		Ensemble::Init(exports);
+		ModelRegistry::Init(exports);
 		NeuralNetwork::Init(exports);
+		SharedNetwork::Init(exports);
 	}
 
 	NODE_MODULE(ann, init)
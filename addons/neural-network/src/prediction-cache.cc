@@ -0,0 +1,185 @@
+#include "prediction-cache.hh"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+namespace ANN
+{
+  PredictionCache::PredictionCache(int capacity, int numInput, int numOutput)
+  {
+    this->slots = capacity < 1 ? 1 : capacity;
+    this->numInput = numInput;
+    this->numOutput = numOutput;
+
+    this->keys = std::vector<float>((size_t)slots * numInput);
+    this->values = std::vector<double>((size_t)slots * numOutput);
+    this->hashes = std::vector<uint64_t>(slots);
+    this->prev = std::vector<int>(slots, -1);
+    this->next = std::vector<int>(slots, -1);
+    this->scratch = std::vector<float>(numInput);
+
+    size_t positions = 1;
+    while (positions < (size_t)slots * 2) positions *= 2;
+    this->table = std::vector<int>(positions, -1);
+    this->mask = positions - 1;
+  }
+
+  uint64_t PredictionCache::hash(const double* x)
+  {
+    // FNV-1a over the bits of each quantized value, then a final mix.
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < numInput; i++)
+    {
+      scratch[i] = (float)x[i];
+      uint32_t bits;
+      memcpy(&bits, &scratch[i], sizeof(bits));
+      h = (h ^ bits) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  size_t PredictionCache::locate(uint64_t h)
+  {
+    // The table is never more than half full, so an empty position is
+    // always reached.
+    size_t i = (size_t)h & mask;
+    while (table[i] >= 0)
+    {
+      int slot = table[i];
+      if (hashes[slot] == h && memcmp(keys.data() + (size_t)slot * numInput, scratch.data(), numInput * sizeof(float)) == 0)
+      {
+        break;
+      }
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  void PredictionCache::erase(int slot)
+  {
+    size_t i = (size_t)hashes[slot] & mask;
+    while (table[i] != slot) i = (i + 1) & mask;
+    table[i] = -1;
+
+    // Shift back the entries after the hole that would no longer be
+    // reached from their home position.
+    size_t j = i;
+    while (true)
+    {
+      j = (j + 1) & mask;
+      if (table[j] < 0) break;
+      size_t home = (size_t)hashes[table[j]] & mask;
+      bool reachable = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+      if (!reachable)
+      {
+        table[i] = table[j];
+        table[j] = -1;
+        i = j;
+      }
+    }
+  }
+
+  void PredictionCache::unlink(int slot)
+  {
+    if (prev[slot] >= 0) next[prev[slot]] = next[slot];
+    else head = next[slot];
+    if (next[slot] >= 0) prev[next[slot]] = prev[slot];
+    else tail = prev[slot];
+    prev[slot] = next[slot] = -1;
+  }
+
+  void PredictionCache::pushFront(int slot)
+  {
+    prev[slot] = -1;
+    next[slot] = head;
+    if (head >= 0) prev[head] = slot;
+    head = slot;
+    if (tail < 0) tail = slot;
+  }
+
+  bool PredictionCache::find(const double* x, double* probs)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    int slot = table[locate(hash(x))];
+    if (slot < 0)
+    {
+      missCount++;
+      return false;
+    }
+    std::copy(values.begin() + (size_t)slot * numOutput, values.begin() + (size_t)(slot + 1) * numOutput, probs);
+    unlink(slot);
+    pushFront(slot);
+    hitCount++;
+    return true;
+  }
+
+  void PredictionCache::insert(const double* x, const double* probs)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t h = hash(x);
+    size_t position = locate(h);
+    int slot = table[position];
+    if (slot >= 0)
+    {
+      // Same row; refresh it.
+      unlink(slot);
+    }
+    else
+    {
+      if (used < slots)
+      {
+        slot = used++;
+      }
+      else
+      {
+        slot = tail;
+        unlink(slot);
+        erase(slot);
+        // Erasing may have shifted entries into the chain.
+        position = locate(h);
+      }
+      std::copy(scratch.begin(), scratch.end(), keys.begin() + (size_t)slot * numInput);
+      hashes[slot] = h;
+      table[position] = slot;
+    }
+
+    std::copy(probs, probs + numOutput, values.begin() + (size_t)slot * numOutput);
+    pushFront(slot);
+  }
+
+  void PredictionCache::clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::fill(table.begin(), table.end(), -1);
+    std::fill(prev.begin(), prev.end(), -1);
+    std::fill(next.begin(), next.end(), -1);
+    head = tail = -1;
+    used = 0;
+  }
+
+  int PredictionCache::capacity()
+  {
+    return slots;
+  }
+
+  int PredictionCache::size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+  }
+
+  long long PredictionCache::hits()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hitCount;
+  }
+
+  long long PredictionCache::misses()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return missCount;
+  }
+}
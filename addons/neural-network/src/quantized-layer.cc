@@ -0,0 +1,119 @@
+#include "quantized-layer.hh"
+#include <math.h>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// AVX-VNNI and AVX512-VNNI name the same 256-bit instruction differently.
+#if defined(__AVX2__) && defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define ANN_VNNI(acc, a, b) _mm256_dpbusd_epi32(acc, a, b)
+#elif defined(__AVX2__) && defined(__AVXVNNI__)
+#define ANN_VNNI(acc, a, b) _mm256_dpbusd_avx_epi32(acc, a, b)
+#endif
+
+namespace ANN
+{
+  QuantizedLayer::QuantizedLayer(Layer& layer, double inputRange)
+  {
+    this->inputs = layer.inputs;
+    this->outputs = layer.outputs;
+    this->stride = (inputs + PADDING - 1) / PADDING * PADDING;
+    this->activation = layer.activation;
+
+    const double* w = layer.weights();
+    double range = 0.0;
+    for (int i = 0; i < inputs * outputs; i++)
+    {
+      if (fabs(w[i]) > range) range = fabs(w[i]);
+    }
+    this->weightScale = range > 0.0 ? range / 127.0 : 1.0;
+    this->inputScale = inputRange > 0.0 ? inputRange / 127.0 : 1.0;
+
+    // Transpose while quantizing so each output reads one contiguous row.
+    this->weights = std::vector<int8_t>((size_t)outputs * stride);
+    this->rowSums = std::vector<int32_t>(outputs);
+    for (int j = 0; j < outputs; j++)
+    {
+      int8_t* row = weights.data() + (size_t)j * stride;
+      for (int i = 0; i < inputs; i++)
+      {
+        long q = lround(w[i * outputs + j] / weightScale);
+        row[i] = (int8_t)(q < -127 ? -127 : q > 127 ? 127 : q);
+        rowSums[j] += row[i];
+      }
+    }
+    this->biases = std::vector<double>(layer.biases(), layer.biases() + outputs);
+  }
+
+  size_t QuantizedLayer::bytes()
+  {
+    return weights.size() * sizeof(int8_t) + biases.size() * sizeof(double);
+  }
+
+  void QuantizedLayer::forward(const double* x, double* y, int8_t* scratch)
+  {
+    for (int i = 0; i < inputs; i++)
+    {
+      long q = lround(x[i] / inputScale);
+      scratch[i] = (int8_t)(q < -127 ? -127 : q > 127 ? 127 : q);
+    }
+    for (int i = inputs; i < stride; i++) scratch[i] = 0;
+
+    double scale = inputScale * weightScale;
+    for (int j = 0; j < outputs; j++)
+    {
+      y[j] = Layer::activate(activation, dot(scratch, j) * scale + biases[j]);
+    }
+  }
+
+  const char* QuantizedLayer::kernel()
+  {
+#if defined(ANN_VNNI)
+    return "vnni";
+#elif defined(__AVX2__)
+    return "avx2";
+#else
+    return "scalar";
+#endif
+  }
+
+  int32_t QuantizedLayer::dot(const int8_t* x, int row)
+  {
+    const int8_t* w = weights.data() + (size_t)row * stride;
+#if defined(ANN_VNNI)
+    // dpbusd multiplies unsigned by signed bytes, so shift the inputs by
+    // 128 and take 128 * sum(w) back off afterwards.
+    const __m256i offset = _mm256_set1_epi8((char)0x80);
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < stride; i += 32)
+    {
+      __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(x + i)), offset);
+      __m256i b = _mm256_loadu_si256((const __m256i*)(w + i));
+      acc = ANN_VNNI(acc, a, b);
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum) - 128 * rowSums[row];
+#elif defined(__AVX2__)
+    // Widen 16 bytes at a time to int16 and multiply-add pairs to int32.
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < stride; i += 16)
+    {
+      __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(x + i)));
+      __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(w + i)));
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < inputs; i++) sum += (int32_t)x[i] * w[i];
+    return sum;
+#endif
+  }
+}
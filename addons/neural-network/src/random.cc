@@ -1,5 +1,6 @@
 #include "random.hh"
 #include <random>
+#include <sstream>
 
 Random::Random()
 {
@@ -39,6 +40,30 @@ double Random::nextDouble(double lower, double upper)
 	return 0.0;
 }
 
+void Random::seed(unsigned value)
+{
+	generator.seed(value);
+	distribution.reset();
+}
+
+std::string Random::state()
+{
+	std::ostringstream stream;
+	stream << generator;
+	return stream.str();
+}
+
+bool Random::restore(const std::string& state)
+{
+	std::istringstream stream(state);
+	std::mt19937 restored;
+	if (!(stream >> restored)) return false;
+	generator = restored;
+	// The distribution may hold values drawn ahead of time.
+	distribution.reset();
+	return true;
+}
+
 double Random::next()
 {
 	return distribution(generator);
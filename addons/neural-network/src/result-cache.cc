@@ -0,0 +1,250 @@
+#include "result-cache.hh"
+#include "tools.hh"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace ANN
+{
+  static const char MAGIC[8] = { 'A', 'N', 'N', 'R', 'E', 'S', 'L', 'T' };
+
+  // FNV-1a of length bytes.
+  static uint64_t Checksum(const char* data, size_t length)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+      hash ^= (uint8_t)data[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  void ResultCache::Key::add(const void* data, size_t length)
+  {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+      // Multiply and fold: unrelated to FNV, so its collisions differ.
+      second = (second + bytes[i] + 1) * 0xff51afd7ed558ccdULL;
+      second ^= second >> 29;
+    }
+  }
+
+  void ResultCache::Key::add(const std::string& s)
+  {
+    // The length keeps neighbouring strings from running together.
+    value<uint64_t>(s.size());
+    add(s.data(), s.size());
+  }
+
+  std::string ResultCache::Key::str() const
+  {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+  }
+
+  uint64_t ResultCache::Key::verifier() const
+  {
+    return second;
+  }
+
+  ResultCache::ResultCache(const std::string& directory, long long budget)
+    : directory(directory), budget(budget)
+  {
+    // Fails harmlessly if the directory is already there; if it cannot be
+    // made, put() reports it.
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0777);
+#endif
+    readIndex();
+  }
+
+  bool ResultCache::get(const Key& key, Checkpoint& state, std::string& log, std::vector<double>& errors)
+  {
+    int i = find(key.str());
+    if (i < 0) return false;
+
+    std::string path = pathOf(key.str());
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+
+    // Magic, version, the key's second hash, then the checkpoint, the log
+    // and the errors (each prefixed by a uint64 count of items) and a
+    // uint64 checksum.
+    size_t header = sizeof(MAGIC) + sizeof(uint32_t) + sizeof(uint64_t);
+    bool valid = bytes.size() >= header + sizeof(uint64_t) && memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) == 0;
+    size_t length = valid ? bytes.size() - sizeof(uint64_t) : 0;
+    if (valid)
+    {
+      uint32_t version;
+      uint64_t checksum;
+      memcpy(&version, bytes.data() + sizeof(MAGIC), sizeof(version));
+      memcpy(&checksum, bytes.data() + length, sizeof(checksum));
+      valid = version == VERSION && Checksum(bytes.data(), length) == checksum;
+    }
+    if (valid)
+    {
+      // An intact entry of another run whose name collides is left for
+      // put() to replace.
+      uint64_t verifier;
+      memcpy(&verifier, bytes.data() + sizeof(MAGIC) + sizeof(uint32_t), sizeof(verifier));
+      if (verifier != key.verifier()) return false;
+    }
+    // Splits off the next section, of items of size bytes each.
+    size_t offset = header;
+    auto next = [&](size_t size, std::string& section)
+    {
+      uint64_t count = 0;
+      if (valid && length - offset >= sizeof(count))
+      {
+        memcpy(&count, bytes.data() + offset, sizeof(count));
+        offset += sizeof(count);
+        valid = count <= (length - offset) / size;
+      }
+      else valid = false;
+      if (!valid) return;
+      section = bytes.substr(offset, (size_t)count * size);
+      offset += (size_t)count * size;
+    };
+    std::string checkpoint;
+    std::string errorBytes;
+    next(1, checkpoint);
+    next(1, log);
+    next(sizeof(double), errorBytes);
+    std::string error;
+    if (!valid || offset != length || !state.parse(checkpoint, path, error))
+    {
+      remove(i);
+      writeIndex();
+      return false;
+    }
+    errors.resize(errorBytes.size() / sizeof(double));
+    if (!errors.empty()) memcpy(errors.data(), errorBytes.data(), errorBytes.size());
+
+    // Move the entry to the most recently used end.
+    Entry entry = index[i];
+    index.erase(index.begin() + i);
+    index.push_back(entry);
+    writeIndex();
+    return true;
+  }
+
+  bool ResultCache::put(const Key& key, const Checkpoint& state, const std::string& log,
+    const std::vector<double>& errors, std::string& error)
+  {
+    std::string name = key.str();
+    std::string checkpoint = state.bytes();
+    std::string bytes(MAGIC, sizeof(MAGIC));
+    uint32_t version = VERSION;
+    uint64_t verifier = key.verifier();
+    uint64_t length = checkpoint.size();
+    bytes.append((const char*)&version, sizeof(version));
+    bytes.append((const char*)&verifier, sizeof(verifier));
+    bytes.append((const char*)&length, sizeof(length));
+    bytes += checkpoint;
+    length = log.size();
+    bytes.append((const char*)&length, sizeof(length));
+    bytes += log;
+    length = errors.size();
+    bytes.append((const char*)&length, sizeof(length));
+    if (!errors.empty()) bytes.append((const char*)errors.data(), errors.size() * sizeof(double));
+    uint64_t checksum = Checksum(bytes.data(), bytes.size());
+    bytes.append((const char*)&checksum, sizeof(checksum));
+
+    int i = find(name);
+    if (i >= 0) remove(i);
+    if ((long long)bytes.size() > budget)
+    {
+      writeIndex();
+      return true;
+    }
+    if (!tools::writeFile(pathOf(name), bytes.data(), bytes.size(), error))
+    {
+      writeIndex();
+      return false;
+    }
+    Entry entry = { name, (long long)bytes.size() };
+    index.push_back(entry);
+
+    // Evict from the least recently used end.
+    long long total = this->bytes();
+    while (total > budget)
+    {
+      total -= index[0].bytes;
+      remove(0);
+    }
+    writeIndex();
+    return true;
+  }
+
+  int ResultCache::entries()
+  {
+    return (int)index.size();
+  }
+
+  long long ResultCache::bytes()
+  {
+    long long total = 0;
+    for (Entry& entry : index) total += entry.bytes;
+    return total;
+  }
+
+  std::string ResultCache::pathOf(const std::string& key)
+  {
+    return directory + "/" + key + ".result";
+  }
+
+  int ResultCache::find(const std::string& key)
+  {
+    for (int i = 0; i < index.size(); i++)
+    {
+      if (index[i].key == key) return i;
+    }
+    return -1;
+  }
+
+  void ResultCache::remove(int i)
+  {
+    ::remove(pathOf(index[i].key).c_str());
+    index.erase(index.begin() + i);
+  }
+
+  void ResultCache::readIndex()
+  {
+    // One "key bytes" line per entry. Anything unreadable is left out
+    // (and its file is left behind).
+    index.clear();
+    std::ifstream file(directory + "/index");
+    std::string line;
+    while (std::getline(file, line))
+    {
+      std::istringstream fields(line);
+      Entry entry;
+      if (fields >> entry.key >> entry.bytes && find(entry.key) < 0) index.push_back(entry);
+    }
+  }
+
+  void ResultCache::writeIndex()
+  {
+    std::string text;
+    for (Entry& entry : index) text += entry.key + " " + std::to_string(entry.bytes) + "\n";
+    // A lost index only costs the entries it listed.
+    std::string error;
+    tools::writeFile(directory + "/index", text.data(), text.size(), error);
+  }
+}
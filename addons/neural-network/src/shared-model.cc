@@ -0,0 +1,233 @@
+#include "shared-model.hh"
+#include "model-file.hh"
+#include <atomic>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ANN
+{
+  static const char MAGIC[8] = { 'A', 'N', 'N', 'S', 'H', 'A', 'R', 'E' };
+  static const uint32_t VERSION = 1;
+
+  // Start of the segment. The slots follow at ModelFile::ALIGN bytes.
+  struct Segment
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t slotBytes;
+    // Generations published so far, and the slot holding the latest.
+    std::atomic<uint64_t> generation;
+    std::atomic<uint64_t> current;
+    // Per slot, odd while being written.
+    std::atomic<uint64_t> sequence[2];
+  };
+
+  static_assert(sizeof(Segment) <= ModelFile::ALIGN, "segment header must fit before the slots");
+
+  // POSIX names start with a single slash.
+  static std::string SegmentName(const std::string& name)
+  {
+    return name.size() > 0 && name[0] == '/' ? name : "/" + name;
+  }
+
+  SharedModel::SharedModel()
+  {
+  }
+
+  SharedModel::~SharedModel()
+  {
+#ifndef _WIN32
+    if (base) munmap(base, length);
+    // Processes still attached keep their mapping.
+    if (owner) shm_unlink(segment.c_str());
+#endif
+  }
+
+  std::unique_ptr<SharedModel> SharedModel::create(const std::string& name, const std::vector<Layer>& layers, std::string& error)
+  {
+#ifdef _WIN32
+    error = "Shared memory models are not supported on Windows.";
+    return nullptr;
+#else
+    std::unique_ptr<SharedModel> shared(new SharedModel());
+    shared->segment = SegmentName(name);
+    std::vector<uint64_t> image = ModelFile::image(layers);
+    shared->slotBytes = image.size() * sizeof(uint64_t);
+    shared->length = ModelFile::ALIGN + 2 * shared->slotBytes;
+
+    // Readers of an old segment keep it; new ones find this one.
+    shm_unlink(shared->segment.c_str());
+    int fd = shm_open(shared->segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+      error = "Cannot create shared memory " + shared->segment + ".";
+      return nullptr;
+    }
+    shared->owner = true;
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)shared->length) == 0)
+    {
+      map = mmap(nullptr, shared->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = "Cannot map shared memory " + shared->segment + ".";
+      return nullptr;
+    }
+    shared->base = (char*)map;
+
+    // A fresh segment is zero filled: no generations, both slots free.
+    Segment* header = (Segment*)shared->base;
+    header->version = VERSION;
+    header->slotBytes = shared->slotBytes;
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    if (!shared->publish(layers, error)) return nullptr;
+    return shared;
+#endif
+  }
+
+  std::unique_ptr<SharedModel> SharedModel::attach(const std::string& name, std::string& error)
+  {
+#ifdef _WIN32
+    error = "Shared memory models are not supported on Windows.";
+    return nullptr;
+#else
+    std::unique_ptr<SharedModel> shared(new SharedModel());
+    shared->segment = SegmentName(name);
+    int fd = shm_open(shared->segment.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+      error = "No shared model is published as " + shared->segment + ".";
+      return nullptr;
+    }
+    struct stat info;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size >= (off_t)ModelFile::ALIGN)
+    {
+      shared->length = (size_t)info.st_size;
+      map = mmap(nullptr, shared->length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = "Cannot map shared memory " + shared->segment + ".";
+      return nullptr;
+    }
+    shared->base = (char*)map;
+
+    const Segment* header = (const Segment*)shared->base;
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION
+      || ModelFile::ALIGN + 2 * header->slotBytes != shared->length)
+    {
+      error = shared->segment + " is not a shared model.";
+      return nullptr;
+    }
+    shared->slotBytes = header->slotBytes;
+    return shared;
+#endif
+  }
+
+  const std::string& SharedModel::name() const
+  {
+    return segment;
+  }
+
+  long long SharedModel::generation() const
+  {
+    return (long long)((const Segment*)base)->generation.load(std::memory_order_acquire);
+  }
+
+  bool SharedModel::publish(const std::vector<Layer>& layers, std::string& error)
+  {
+    std::vector<int> topology(1, layers.front().inputs);
+    for (const Layer& layer : layers) topology.push_back(layer.outputs);
+    if (shape.empty()) shape = topology;
+    std::vector<uint64_t> image = ModelFile::image(layers);
+    size_t bytes = image.size() * sizeof(uint64_t);
+    if (topology != shape || bytes > slotBytes)
+    {
+      error = "The topology published to " + segment + " cannot change.";
+      return false;
+    }
+
+    // Write the slot readers are not pointed at. Only a reader overtaken
+    // by two generations can see it change under it.
+    Segment* header = (Segment*)base;
+    int slot = header->generation.load(std::memory_order_relaxed) == 0 ? 0 : 1 - (int)header->current.load(std::memory_order_relaxed);
+    header->sequence[slot].fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(base + ModelFile::ALIGN + slot * slotBytes, image.data(), bytes);
+    header->sequence[slot].fetch_add(1, std::memory_order_release);
+
+    header->current.store(slot, std::memory_order_release);
+    header->generation.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+
+  std::shared_ptr<const Model> SharedModel::view(int slot, uint64_t sequence, std::string& error)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!views[slot] || viewed[slot] != sequence)
+    {
+      views[slot].reset();
+      std::shared_ptr<const ModelFile> file = ModelFile::view(base + ModelFile::ALIGN + slot * slotBytes, slotBytes, error);
+      if (!file) return nullptr;
+      views[slot] = std::make_shared<const Model>(file);
+      viewed[slot] = sequence;
+    }
+    return views[slot];
+  }
+
+  long long SharedModel::predict(const double* x, int rows, double* probs, std::string& error)
+  {
+    const Segment* header = (const Segment*)base;
+    while (true)
+    {
+      uint64_t generation = header->generation.load(std::memory_order_acquire);
+      if (generation == 0)
+      {
+        error = "Nothing has been published to " + segment + " yet.";
+        return -1;
+      }
+      int slot = (int)header->current.load(std::memory_order_acquire);
+      uint64_t sequence = header->sequence[slot].load(std::memory_order_acquire);
+      // Being rewritten: the publisher has moved on to a newer slot.
+      if (sequence & 1) continue;
+
+      std::shared_ptr<const Model> model = view(slot, sequence, error);
+      if (model) model->predict(x, rows, probs);
+
+      // Keep the reads above from moving past the check.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->sequence[slot].load(std::memory_order_relaxed) != sequence) continue;
+      if (!model) return -1;
+      return (long long)generation;
+    }
+  }
+
+  std::vector<int> SharedModel::topology()
+  {
+    const Segment* header = (const Segment*)base;
+    while (header->generation.load(std::memory_order_acquire) > 0)
+    {
+      int slot = (int)header->current.load(std::memory_order_acquire);
+      uint64_t sequence = header->sequence[slot].load(std::memory_order_acquire);
+      if (sequence & 1) continue;
+      std::string error;
+      std::shared_ptr<const Model> model = view(slot, sequence, error);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->sequence[slot].load(std::memory_order_relaxed) != sequence) continue;
+      if (model) return model->sizes();
+      break;
+    }
+    return std::vector<int>();
+  }
+}
@@ -0,0 +1,179 @@
+#include "shared-network.hh"
+#include "neural-network.hh"
+#include <algorithm>
+
+namespace ANN
+{
+  using v8::Array;
+  using v8::ArrayBuffer;
+  using v8::Context;
+  using v8::Exception;
+  using v8::Float64Array;
+  using v8::FunctionTemplate;
+  using v8::Int32Array;
+  using v8::Isolate;
+  using v8::MaybeLocal;
+  using v8::Number;
+  using v8::String;
+
+  Persistent<Function> SharedNetwork::constructor;
+
+  void SharedNetwork::Init(Local<Object> exports)
+  {
+    Isolate* isolate = exports->GetIsolate();
+
+    // Prepare constructor template.
+    Local<FunctionTemplate> tmpl = FunctionTemplate::New(isolate, New);
+    tmpl->SetClassName(String::NewFromUtf8(isolate, "SharedNetwork"));
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Add methods to prototype.
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "predict", Predict);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "generation", Generation);
+    NODE_SET_PROTOTYPE_METHOD(tmpl, "topology", Topology);
+
+    // Export new item.
+    constructor.Reset(isolate, tmpl->GetFunction());
+    exports->Set(
+      String::NewFromUtf8(isolate, "SharedNetwork"),
+      tmpl->GetFunction()
+    );
+  }
+
+  void SharedNetwork::New(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    if (args.IsConstructCall())
+    {
+      // SharedNetwork invoked as constructor.
+      // Get arguments: name of the shared memory segment.
+      if (!args[0]->IsString())
+      {
+        isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "First argument must be a defined string.")
+        ));
+        return;
+      }
+      std::string error;
+      std::unique_ptr<SharedModel> shared = SharedModel::attach(*String::Utf8Value(args[0]), error);
+      if (!shared)
+      {
+        isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, error.c_str())
+        ));
+        return;
+      }
+
+      SharedNetwork* network = new SharedNetwork(std::move(shared));
+      network->Wrap(args.This());
+      args.GetReturnValue().Set(args.This());
+    }
+    else
+    {
+      Attach(args);
+    }
+  }
+
+  void SharedNetwork::Attach(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    const int argc = 1;
+    Local<Value> argv[argc] = { args[0] };
+    Local<Context> context = isolate->GetCurrentContext();
+    Local<Function> construct = Local<Function>::New(isolate, constructor);
+    Local<Object> result;
+    // Left empty if the constructor threw.
+    if (construct->NewInstance(context, argc, argv).ToLocal(&result))
+    {
+      args.GetReturnValue().Set(result);
+    }
+  }
+
+  SharedNetwork::SharedNetwork(std::unique_ptr<SharedModel> shared)
+  {
+    this->shared = std::move(shared);
+    this->topology = this->shared->topology();
+  }
+
+  void SharedNetwork::Predict(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+
+    // Unwrap SharedNetwork.
+    SharedNetwork* network = ObjectWrap::Unwrap<SharedNetwork>(args.Holder());
+    if (network->topology.empty())
+    {
+      isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Nothing usable has been published.")
+      ));
+      return;
+    }
+
+    // Get arguments: rows to predict, and optionally 'argmax'.
+    bool argmax = args.Length() > 1 && args[1]->IsString()
+      && std::string(*String::Utf8Value(args[1])) == "argmax";
+
+    int numInput = network->topology.front();
+    int numOutput = network->topology.back();
+    NeuralNetwork::PredictInput input;
+    std::vector<double> copy;
+    if (!NeuralNetwork::ReadPredictInput(isolate, args[0], numInput, input, copy)) return;
+
+    size_t count = argmax ? (size_t)input.rows : (size_t)input.rows * numOutput;
+    size_t bytes = count * (argmax ? sizeof(int) : sizeof(double));
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, bytes);
+    void* data = buffer->GetContents().Data();
+
+    // Rows go through the weights a block at a time.
+    std::vector<double> x((size_t)Model::BLOCK * numInput);
+    std::vector<double> probs((size_t)Model::BLOCK * numOutput);
+    std::string error;
+    for (int first = 0; first < input.rows; first += Model::BLOCK)
+    {
+      int rows = std::min(Model::BLOCK, input.rows - first);
+      for (int r = 0; r < rows; r++)
+      {
+        NeuralNetwork::CopyRow(input, first + r, numInput, x.data() + (size_t)r * numInput);
+      }
+      double* out = argmax ? probs.data() : (double*)data + (size_t)first * numOutput;
+      if (network->shared->predict(x.data(), rows, out, error) < 0)
+      {
+        isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, error.c_str())
+        ));
+        return;
+      }
+      if (!argmax) continue;
+      for (int r = 0; r < rows; r++)
+      {
+        const double* p = out + (size_t)r * numOutput;
+        ((int*)data)[first + r] = (int)(std::max_element(p, p + numOutput) - p);
+      }
+    }
+
+    if (argmax) args.GetReturnValue().Set(Int32Array::New(buffer, 0, count));
+    else args.GetReturnValue().Set(Float64Array::New(buffer, 0, count));
+  }
+
+  void SharedNetwork::Generation(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap SharedNetwork.
+    SharedNetwork* network = ObjectWrap::Unwrap<SharedNetwork>(args.Holder());
+    args.GetReturnValue().Set(Number::New(isolate, (double)network->shared->generation()));
+  }
+
+  void SharedNetwork::Topology(const FunctionCallbackInfo<Value>& args)
+  {
+    Isolate* isolate = args.GetIsolate();
+    // Unwrap SharedNetwork.
+    SharedNetwork* network = ObjectWrap::Unwrap<SharedNetwork>(args.Holder());
+    Local<Array> sizes = Array::New(isolate, (int)network->topology.size());
+    for (int l = 0; l < network->topology.size(); l++)
+    {
+      sizes->Set(l, Number::New(isolate, network->topology[l]));
+    }
+    args.GetReturnValue().Set(sizes);
+  }
+}
@@ -0,0 +1,138 @@
+#include "snapshot-writer.hh"
+#include "model-file.hh"
+#include <algorithm>
+
+namespace ANN
+{
+  SnapshotWriter::SnapshotWriter(int buffers, SnapshotPolicy policy)
+  {
+    this->onFull = policy;
+    this->slots = std::vector<Buffer>(std::max(1, buffers));
+    for (int i = 0; i < slots.size(); i++) this->idle.push_back(i);
+    this->thread = std::thread(&SnapshotWriter::run, this);
+  }
+
+  SnapshotWriter::~SnapshotWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+  }
+
+  int SnapshotWriter::buffers()
+  {
+    return (int)slots.size();
+  }
+
+  SnapshotPolicy SnapshotWriter::policy()
+  {
+    return onFull;
+  }
+
+  bool SnapshotWriter::submit(const std::string& path, const std::vector<Layer>& layers)
+  {
+    int slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (idle.empty() && onFull == SnapshotPolicy::Drop)
+      {
+        droppedCount++;
+        return false;
+      }
+      changed.wait(lock, [this] { return !idle.empty(); });
+      slot = idle.back();
+      idle.pop_back();
+    }
+
+    // The buffer belongs to this thread until it is queued, so the copy
+    // is made without the lock. Buffers keep their memory between uses.
+    Buffer& buffer = slots[slot];
+    buffer.path = path;
+    buffer.topology.assign(1, layers.front().inputs);
+    buffer.activations.clear();
+    buffer.params.resize(layers.size());
+    for (int l = 0; l < layers.size(); l++)
+    {
+      buffer.topology.push_back(layers[l].outputs);
+      buffer.activations.push_back(layers[l].activation);
+      buffer.params[l].assign(layers[l].params.begin(), layers[l].params.end());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(slot);
+    }
+    changed.notify_all();
+    return true;
+  }
+
+  void SnapshotWriter::flush()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return queue.empty() && !writing; });
+  }
+
+  void SnapshotWriter::run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      changed.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      int slot = queue.front();
+      queue.pop_front();
+      writing = true;
+      lock.unlock();
+
+      Buffer& buffer = slots[slot];
+      std::vector<const double*> params;
+      for (const std::vector<double>& block : buffer.params) params.push_back(block.data());
+      std::string failure;
+      bool ok = ModelFile::write(buffer.path, buffer.topology, buffer.activations, params, failure);
+
+      lock.lock();
+      if (ok) writtenCount++;
+      else
+      {
+        failedCount++;
+        error = failure;
+      }
+      writing = false;
+      idle.push_back(slot);
+      changed.notify_all();
+    }
+  }
+
+  long long SnapshotWriter::written()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writtenCount;
+  }
+
+  long long SnapshotWriter::dropped()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedCount;
+  }
+
+  long long SnapshotWriter::failed()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failedCount;
+  }
+
+  int SnapshotWriter::pending()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)queue.size() + (writing ? 1 : 0);
+  }
+
+  std::string SnapshotWriter::lastError()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+  }
+}
@@ -0,0 +1,296 @@
+#include "table-reader.hh"
+#include "thread-pool.hh"
+#include "tools.hh"
+#include <algorithm>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+TableReader::TableReader(const std::vector<char>& delims, int threads)
+{
+	for (int c = 0; c < 256; c++) separator[c] = isspace(c) != 0;
+	for (char delim : delims) separator[(unsigned char)delim] = true;
+	if (threads <= 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+	this->threads = threads;
+}
+
+bool TableReader::read(const std::string& path, std::vector<double>& values, int& rows, int& cols, std::string& error)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		error = "File " + path + " does not exist.";
+		return false;
+	}
+
+#ifdef _WIN32
+	struct _stat64 info;
+	bool large = _fstat64(_fileno(file), &info) == 0 && (unsigned long long)info.st_size >= PARALLEL_MIN_BYTES;
+#else
+	struct stat info;
+	bool large = fstat(fileno(file), &info) == 0 && (unsigned long long)info.st_size >= PARALLEL_MIN_BYTES;
+#endif
+	bool parsed;
+	if (!large || threads < 2)
+	{
+		parsed = readStream(file, values, rows, cols, error);
+	}
+	else
+	{
+		size_t length = (size_t)info.st_size;
+#ifdef _WIN32
+		// Read once into memory where mapping is not available.
+		std::vector<char> text(length);
+		if (fread(text.data(), 1, length, file) != length)
+		{
+			fclose(file);
+			error = "Cannot read " + path + ".";
+			return false;
+		}
+		parsed = readParallel(text.data(), length, values, rows, cols, error);
+#else
+		void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (map == MAP_FAILED)
+		{
+			parsed = readStream(file, values, rows, cols, error);
+		}
+		else
+		{
+			// Every page is about to be read, by several threads at once.
+			madvise(map, length, MADV_WILLNEED);
+			parsed = readParallel((const char*)map, length, values, rows, cols, error);
+			munmap(map, length);
+		}
+#endif
+	}
+
+	bool ok = parsed && !ferror(file);
+	if (!parsed) error = path + ": " + error;
+	else if (!ok) error = "Cannot read " + path + ".";
+	fclose(file);
+	return ok;
+}
+
+bool TableReader::readStream(FILE* file, std::vector<double>& values, int& rows, int& cols, std::string& error)
+{
+	values.clear();
+	rows = 0;
+	cols = 0;
+	std::vector<char> buffer(BUFFER_SIZE);
+	// Bytes in the buffer not yet parsed: the start of a line whose end
+	// has not been read.
+	size_t used = 0;
+	long long line = 1;
+	while (true)
+	{
+		if (used == buffer.size()) buffer.resize(2 * buffer.size());
+		size_t got = fread(buffer.data() + used, 1, buffer.size() - used, file);
+		used += got;
+		// Once nothing more comes, the last line needs no line break.
+		bool last = got == 0;
+
+		const char* p = buffer.data();
+		const char* end = p + used;
+		while (true)
+		{
+			const char* eol = (const char*)memchr(p, '\n', end - p);
+			if (!eol)
+			{
+				if (!last || p == end) break;
+				eol = end;
+			}
+			size_t before = values.size();
+			int count = parseLine(p, eol, line, values, error);
+			if (count < 0) return false;
+			if (count > 0)
+			{
+				if (rows == 0) cols = count;
+				if (count != cols)
+				{
+					error = "line " + std::to_string(line) + ": expected " + std::to_string(cols)
+						+ " values, found " + std::to_string(count) + ".";
+					values.resize(before);
+					return false;
+				}
+				rows++;
+			}
+			line++;
+			p = eol < end ? eol + 1 : end;
+		}
+		used = end - p;
+		memmove(buffer.data(), p, used);
+		if (last) return true;
+	}
+}
+
+bool TableReader::readParallel(const char* data, size_t length, std::vector<double>& values, int& rows, int& cols, std::string& error)
+{
+	// Cut the text into a range per thread, each ending after a line
+	// break (or at the end of the text).
+	const char* end = data + length;
+	std::vector<Range> ranges(threads);
+	const char* at = data;
+	for (int i = 0; i < threads; i++)
+	{
+		ranges[i].begin = at;
+		if (i == threads - 1)
+		{
+			at = end;
+		}
+		else
+		{
+			at = std::max(at, data + length / threads * (i + 1));
+			const char* eol = (const char*)memchr(at, '\n', end - at);
+			at = eol ? eol + 1 : end;
+		}
+		ranges[i].end = at;
+	}
+
+	// The first row sets the number of columns.
+	cols = 0;
+	long long line = 1;
+	for (const char* p = data; p < end; line++)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+		if (!blank(p, eol))
+		{
+			std::vector<double> first;
+			cols = parseLine(p, eol, line, first, error);
+			if (cols < 0) return false;
+			break;
+		}
+		p = eol < end ? eol + 1 : end;
+	}
+
+	// Count the rows of each range, then place them one after another.
+	ThreadPool pool(threads);
+	auto counting = [&](int worker)
+	{
+		countRows(ranges[worker]);
+	};
+	pool.run(counting);
+	long long total = 0;
+	line = 1;
+	for (Range& range : ranges)
+	{
+		range.row = total;
+		range.line = line;
+		total += range.rows;
+		line += range.lines;
+	}
+	if (total > INT_MAX)
+	{
+		error = "too many rows.";
+		return false;
+	}
+	rows = (int)total;
+	values.resize((size_t)total * cols);
+
+	// Parse each range into its place. The error reported is the first in
+	// the text, as it would be reading from the start.
+	auto parsing = [&](int worker)
+	{
+		parse(ranges[worker], values.data(), cols);
+	};
+	pool.run(parsing);
+	for (Range& range : ranges)
+	{
+		if (!range.error.empty())
+		{
+			error = range.error;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TableReader::blank(const char* begin, const char* end) const
+{
+	for (const char* p = begin; p < end; p++)
+	{
+		if (!separator[(unsigned char)*p]) return false;
+	}
+	return true;
+}
+
+void TableReader::countRows(Range& range) const
+{
+	range.lines = 0;
+	range.rows = 0;
+	const char* p = range.begin;
+	while (p < range.end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', range.end - p);
+		if (eol) range.lines++;
+		else eol = range.end;
+		if (!blank(p, eol)) range.rows++;
+		p = eol < range.end ? eol + 1 : range.end;
+	}
+}
+
+bool TableReader::parse(Range& range, double* values, int cols) const
+{
+	double* row = values + (size_t)range.row * cols;
+	long long line = range.line;
+	const char* p = range.begin;
+	while (p < range.end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', range.end - p);
+		if (!eol) eol = range.end;
+		int count = parseLine(p, eol, line, row, cols, range.error);
+		if (count < 0) return false;
+		if (count > 0)
+		{
+			if (count != cols)
+			{
+				range.error = "line " + std::to_string(line) + ": expected " + std::to_string(cols)
+					+ " values, found " + std::to_string(count) + ".";
+				return false;
+			}
+			row += cols;
+		}
+		line++;
+		p = eol < range.end ? eol + 1 : range.end;
+	}
+	return true;
+}
+
+int TableReader::parseLine(const char* begin, const char* end, long long line, double* values, int capacity, std::string& error) const
+{
+	int count = 0;
+	const char* p = begin;
+	while (true)
+	{
+		while (p < end && separator[(unsigned char)*p]) p++;
+		if (p == end) break;
+		const char* token = p;
+		while (p < end && !separator[(unsigned char)*p]) p++;
+		double value;
+		if (!tools::parseNumber(token, p, value))
+		{
+			error = "line " + std::to_string(line) + ", column " + std::to_string(token - begin + 1)
+				+ ": '" + std::string(token, p) + "' is not a number.";
+			return -1;
+		}
+		if (count < capacity) values[count] = value;
+		count++;
+	}
+	return count;
+}
+
+int TableReader::parseLine(const char* begin, const char* end, long long line, std::vector<double>& values, std::string& error) const
+{
+	// A line holds at most one value per two characters, rounded up.
+	size_t before = values.size();
+	values.resize(before + (end - begin + 1) / 2);
+	int count = parseLine(begin, end, line, values.data() + before, (int)(values.size() - before), error);
+	values.resize(before + std::max(count, 0));
+	return count;
+}
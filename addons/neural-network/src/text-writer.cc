@@ -0,0 +1,154 @@
+#include "text-writer.hh"
+#include "tools.hh"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+TextWriter::TextWriter() : buffer(BUFFER_SIZE)
+{
+}
+
+TextWriter::TextWriter(const std::string& path, bool append, bool binary) : buffer(BUFFER_SIZE)
+{
+#ifdef _WIN32
+	// Text mode, so that line endings come out as they did through
+	// std::ofstream.
+	int mode = (append ? _O_APPEND : _O_TRUNC) | (binary ? _O_BINARY : _O_TEXT);
+	fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | mode, _S_IREAD | _S_IWRITE);
+#else
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+#endif
+	failed = fd < 0;
+}
+
+TextWriter::~TextWriter()
+{
+	flush();
+	if (fd < 0) return;
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+bool TextWriter::good()
+{
+	return !failed;
+}
+
+void TextWriter::write(const char* text, size_t length)
+{
+	if (length > BUFFER_SIZE - used)
+	{
+		flush();
+		// Too long to be worth copying into the buffer.
+		if (length > BUFFER_SIZE)
+		{
+			send(text, length);
+			return;
+		}
+	}
+	memcpy(buffer.data() + used, text, length);
+	used += length;
+}
+
+void TextWriter::write(const std::string& text)
+{
+	write(text.data(), text.size());
+}
+
+void TextWriter::write(char c)
+{
+	if (used == BUFFER_SIZE) flush();
+	buffer[used++] = c;
+}
+
+void TextWriter::writeInt(long long value)
+{
+	char text[24];
+	int length = snprintf(text, sizeof(text), "%lld", value);
+	write(text, length);
+}
+
+void TextWriter::writeNumber(double value, int precision, int padding)
+{
+	// Format in place when there is room, leaving space for the padding
+	// to be put in front.
+	size_t room = BUFFER_SIZE - used;
+	if (room < 64 + (size_t)padding)
+	{
+		flush();
+		room = BUFFER_SIZE;
+	}
+	char* at = buffer.data() + used;
+	int length = tools::format(value, precision, at, room);
+	if (length >= (int)room)
+	{
+		// Larger than the whole buffer.
+		std::string text = tools::toString(value, precision);
+		if (padding > (int)text.size()) text.insert(text.begin(), padding - text.size(), ' ');
+		write(text);
+		return;
+	}
+	if (padding > length)
+	{
+		memmove(at + padding - length, at, length);
+		memset(at, ' ', padding - length);
+		length = padding;
+	}
+	used += length;
+}
+
+void TextWriter::writeRow(const double* values, size_t count, int precision, bool verbose, int padding)
+{
+	if (verbose) write("[ ", 2);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i > 0) write(' ');
+		writeNumber(values[i], precision, padding);
+	}
+	if (verbose) write(" ]", 2);
+}
+
+void TextWriter::flush()
+{
+	send(buffer.data(), used);
+	used = 0;
+}
+
+const std::string& TextWriter::str()
+{
+	flush();
+	return output;
+}
+
+void TextWriter::send(const char* data, size_t length)
+{
+	if (fd < 0)
+	{
+		output.append(data, length);
+		return;
+	}
+	while (length > 0 && !failed)
+	{
+#ifdef _WIN32
+		int written = _write(fd, data, (unsigned)length);
+#else
+		ssize_t written = ::write(fd, data, length);
+#endif
+		if (written <= 0) failed = true;
+		else
+		{
+			data += written;
+			length -= written;
+		}
+	}
+}
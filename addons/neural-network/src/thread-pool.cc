@@ -0,0 +1,128 @@
+#include "thread-pool.hh"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Number of times a waiting thread polls before yielding or sleeping.
+static const int SPIN_LIMIT = 4096;
+
+Barrier::Barrier(int count)
+{
+	this->count = count;
+	this->waiting = 0;
+	this->generation = 0;
+}
+
+void Barrier::reset(int count)
+{
+	this->count = count;
+	this->waiting = 0;
+}
+
+void Barrier::wait()
+{
+	int gen = generation.load(std::memory_order_acquire);
+	// The last thread to arrive releases everyone else.
+	if (waiting.fetch_add(1, std::memory_order_acq_rel) == count - 1)
+	{
+		waiting.store(0, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_acq_rel);
+		return;
+	}
+	int spins = 0;
+	while (generation.load(std::memory_order_acquire) == gen)
+	{
+		if (++spins > SPIN_LIMIT) std::this_thread::yield();
+	}
+}
+
+ThreadPool::ThreadPool(int threads)
+{
+	this->count = threads < 1 ? 1 : threads;
+	this->phase.reset(this->count);
+	this->generation = 0;
+	this->remaining = 0;
+	for (int i = 1; i < this->count; i++)
+	{
+		this->threads.push_back(std::thread(&ThreadPool::loop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		generation.fetch_add(1, std::memory_order_acq_rel);
+	}
+	wake.notify_all();
+	for (std::thread& thread : threads) thread.join();
+}
+
+int ThreadPool::size()
+{
+	return count;
+}
+
+Barrier& ThreadPool::barrier()
+{
+	return phase;
+}
+
+void ThreadPool::dispatch(void (*invoke)(void*, int), void* task)
+{
+	if (count == 1)
+	{
+		invoke(task, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->invoke = invoke;
+		this->task = task;
+		remaining.store(count - 1, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_acq_rel);
+	}
+	wake.notify_all();
+
+	// The calling thread is worker 0.
+	invoke(task, 0);
+
+	// Wait for the other workers to finish.
+	int spins = 0;
+	while (remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (++spins > SPIN_LIMIT) std::this_thread::yield();
+	}
+}
+
+void ThreadPool::loop(int worker)
+{
+	int seen = 0;
+	while (true)
+	{
+		// Poll for a little while before sleeping, since back-to-back
+		// tasks are the common case when training.
+		int spins = 0;
+		while (generation.load(std::memory_order_acquire) == seen && spins < SPIN_LIMIT) spins++;
+		if (generation.load(std::memory_order_acquire) == seen)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return generation.load(std::memory_order_acquire) != seen; });
+		}
+
+		void (*invoke)(void*, int);
+		void* task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			seen = generation.load(std::memory_order_acquire);
+			if (stopping) return;
+			invoke = this->invoke;
+			task = this->task;
+		}
+
+		invoke(task, worker);
+		remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
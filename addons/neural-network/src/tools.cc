@@ -1,25 +1,54 @@
 #include "tools.hh"
-#include <regex>
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <iomanip>
 #include <iostream>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace tools
 {
 	std::string toString(double value, int precision)
 	{
-		// Open a stream to write the value to.
-		std::stringstream stream;
-		// Set decimal style to fixed.
-		stream.flags(std::ios_base::fixed);
-		// Set the double precision.
-		stream.precision(precision);
-		// Add the value into the stream.
-		stream << value;
-		// Return the string value of the stream.
-		return stream.str();
+		// Most values fit on the stack; very large ones or very high
+		// precisions are formatted again into a string of the right size.
+		char text[64];
+		int length = format(value, precision, text, sizeof(text));
+		if (length < (int)sizeof(text)) return std::string(text, length);
+		std::string output(length + 1, '\0');
+		format(value, precision, &output[0], output.size());
+		output.resize(length);
+		return output;
+	}
+
+	int format(double value, int precision, char* output, size_t size)
+	{
+		if (precision != SHORTEST)
+		{
+			// Same text as a stream set to fixed with this precision.
+			return snprintf(output, size, "%.*f", precision, value);
+		}
+		// 15 significant digits (trailing zeros dropped) where that reads
+		// back as value, otherwise 16 or 17, which always do.
+		char text[32];
+		int length = 0;
+		for (int digits = 15; digits <= 17; digits++)
+		{
+			length = snprintf(text, sizeof(text), "%.*g", digits, value);
+			if (digits == 17 || strtod(text, NULL) == value || value != value) break;
+		}
+		if ((size_t)length < size) memcpy(output, text, length + 1);
+		return length;
 	}
 
 	std::string trim(const std::string& s)
@@ -32,15 +61,12 @@ namespace tools
 
 	void trim_ref(std::string& s)
 	{
-		// Create a regular expression to match.
-		std::regex r("\\s*(.*?)\\s*");
-		// Create an array to hold matches.
-		std::smatch matches;
-		// Execute the regular expression on the input string.
-		if (std::regex_match(s, matches, r))
-		{
-			s = matches[1];
-		}
+		// Same characters as \s: space, \t, \n, \v, \f and \r.
+		size_t begin = 0;
+		size_t end = s.size();
+		while (begin < end && isspace((unsigned char)s[begin])) begin++;
+		while (end > begin && isspace((unsigned char)s[end - 1])) end--;
+		s = s.substr(begin, end - begin);
 	}
 
 	std::vector<std::string> split(const std::string& s, const char delim)
@@ -53,29 +79,122 @@ namespace tools
 		// Setup vector to hold the split strings.
 		std::vector<std::string> output;
 
-		// Combine the delimiters into a single string.
-		std::string d;
-		for (const char& delim : delims) d += delim;
-
-		// Create regular expression.
-		std::regex r("([" + d + "]*)([^" + d + "]+)(?:.*|[\n\r]*)*");
-		// Setup vector to hold matches.
-		std::smatch matches;
-		// Offset the begin iterator by this each time.
-		int offset = 0;
-
-		// Continuously find matches (NOTE: technically infinite).
-		while (std::regex_match(s.cbegin() + offset, s.cend(), matches, r))
+		// Each run of characters that are not delimiters is a substring.
+		size_t at = 0;
+		while (at < s.size())
 		{
-			// Add the non-delimiter match to the output vector.
-			output.push_back(matches[2]);
-			// Add the length of the matched groups to the offset.
-			offset += matches[1].length() + matches[2].length();
-			// If offset has overflown, break the loop.
-			if (offset >= s.length()) break;
+			while (at < s.size() && std::find(delims.begin(), delims.end(), s[at]) != delims.end()) at++;
+			size_t begin = at;
+			while (at < s.size() && std::find(delims.begin(), delims.end(), s[at]) == delims.end()) at++;
+			if (at > begin) output.push_back(s.substr(begin, at - begin));
 		}
 
 		// Return the output vector.
 		return output;
 	}
+
+	bool parseNumber(const char* begin, const char* end, double& value)
+	{
+		// Plain decimals with at most 19 digits, whose digits fit in a
+		// double exactly and are scaled by at most 10^22, come out
+		// correctly rounded from a single multiplication or division.
+		static const double POWERS[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		const char* p = begin;
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+')) p++;
+		unsigned long long digits = 0;
+		int count = 0;
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			digits = digits * 10 + (*p++ - '0');
+			count++;
+		}
+		if (p < end && *p == '.')
+		{
+			p++;
+			while (p < end && *p >= '0' && *p <= '9')
+			{
+				digits = digits * 10 + (*p++ - '0');
+				count++;
+				exponent--;
+			}
+		}
+		bool plain = count > 0;
+		if (plain && p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+			bool negativeExponent = p < end && *p == '-';
+			if (p < end && (*p == '-' || *p == '+')) p++;
+			int power = 0;
+			const char* first = p;
+			while (p < end && *p >= '0' && *p <= '9' && power < 10000) power = power * 10 + (*p++ - '0');
+			plain = p > first;
+			exponent += negativeExponent ? -power : power;
+		}
+		if (plain && p == end && count <= 19 && digits <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+		{
+			value = exponent < 0 ? (double)digits / POWERS[-exponent] : (double)digits * POWERS[exponent];
+			if (negative) value = -value;
+			return true;
+		}
+
+		// Anything else (more digits, larger exponents, inf, nan, hex) is
+		// left to strtod, which must take the whole of the text.
+		if (begin == end || isspace((unsigned char)*begin)) return false;
+		char text[64];
+		std::string copy;
+		const char* terminated = text;
+		size_t length = end - begin;
+		if (length < sizeof(text))
+		{
+			memcpy(text, begin, length);
+			text[length] = '\0';
+		}
+		else
+		{
+			copy.assign(begin, end);
+			terminated = copy.c_str();
+		}
+		char* stop;
+		value = strtod(terminated, &stop);
+		return stop == terminated + length;
+	}
+
+	bool writeFile(
+		const std::string& path,
+		const void* data,
+		size_t length,
+		std::string& error
+	)
+	{
+		std::string temporary = path + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (!file)
+		{
+			error = "Cannot write " + path + ".";
+			return false;
+		}
+		bool written = fwrite(data, 1, length, file) == length && fflush(file) == 0;
+#ifdef _WIN32
+		written = written && _commit(_fileno(file)) == 0;
+#else
+		written = written && fsync(fileno(file)) == 0;
+#endif
+		written = fclose(file) == 0 && written;
+#ifdef _WIN32
+		// rename() does not replace an existing file on Windows.
+		if (written) remove(path.c_str());
+#endif
+		if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			remove(temporary.c_str());
+			error = "Cannot write " + path + ".";
+			return false;
+		}
+		return true;
+	}
 }
@@ -0,0 +1,51 @@
+#include "training-metrics.hh"
+#include <atomic>
+
+namespace ANN
+{
+  size_t TrainingMetrics::size(int capacity)
+  {
+    return HEADER + (size_t)capacity * FIELDS;
+  }
+
+  TrainingMetrics::TrainingMetrics(double* data, int capacity) : data(data), capacity(capacity)
+  {
+    data[0] = capacity;
+    data[1] = FIELDS;
+  }
+
+  void TrainingMetrics::start()
+  {
+    count = 0;
+    data[4] = 0;
+    data[3] = 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    data[2] = data[2] + 1;
+  }
+
+  void TrainingMetrics::stop()
+  {
+    std::atomic_thread_fence(std::memory_order_release);
+    data[3] = 0;
+  }
+
+  void TrainingMetrics::push(int epoch, double trainMSE, double testMSE, double trainAccuracy, double testAccuracy, double samplesPerSecond)
+  {
+    volatile double* record = data + HEADER + (count % capacity) * FIELDS;
+    // The fences keep the stores in order for the reader on the other
+    // thread: odd sequence number, values, even sequence number, count.
+    record[0] = (double)(2 * count + 1);
+    std::atomic_thread_fence(std::memory_order_release);
+    record[1] = epoch;
+    record[2] = trainMSE;
+    record[3] = testMSE;
+    record[4] = trainAccuracy;
+    record[5] = testAccuracy;
+    record[6] = samplesPerSecond;
+    std::atomic_thread_fence(std::memory_order_release);
+    record[0] = (double)(2 * count + 2);
+    std::atomic_thread_fence(std::memory_order_release);
+    count++;
+    data[4] = (double)count;
+  }
+}
@@ -5,6 +5,14 @@ var get = require('./../modules/get');
 var createElement = require('./../modules/create-element');
 var Stopwatch = require('./../modules/stopwatch');
 
+// Seed for the random generators, so that each run repeats the last one
+// unless something changed.
+var SEED = 1;
+// Finished runs are kept here and read back instead of retrained.
+var TRAIN_OPTIONS = { resultCache: 'logs/cache' };
+// Set while a page is training; only one network may train at a time.
+var training = false;
+
 var Page = function(name, run) {
   // Set initial name.
   this.name = name;
@@ -47,7 +55,9 @@ var Page = function(name, run) {
               on: {
                 click: (function(page) {
                   return function() {
-                    page.run();
+                    if (!training) {
+                      page.run();
+                    }
                   };
                 })(this)
               }
@@ -72,8 +82,8 @@ var Page = function(name, run) {
   this.update = function() {
 
   };
-  // Populates chart with the supplied testing and training data.
-  this.populateChart = function() {
+  // Creates the chart, if not done already.
+  this.createChart = function() {
     if (this.chart === null) {
       // Create chart.
       this.chart = new Chart(this.output.chart.querySelector('canvas'), {
@@ -121,6 +131,10 @@ var Page = function(name, run) {
         }
       });
     }
+  };
+  // Populates chart with the supplied testing and training data.
+  this.populateChart = function() {
+    this.createChart();
     // Now, (re)populate chart.
     var training = this.nn.trainingAccuracy();
     var testing = this.nn.testingAccuracy();
@@ -137,6 +151,59 @@ var Page = function(name, run) {
 
     this.chart.update();
   };
+  // Trains this.nn without blocking the page, drawing each epoch on the
+  // chart as it ends. Calls done() once training has finished, or logs
+  // the error if it failed.
+  this.train = function(sets, epochs, eta, logPath, done) {
+    this.createChart();
+    var trainingPoints = this.chart.data.datasets[0].data = [];
+    var testingPoints = this.chart.data.datasets[1].data = [];
+    this.chart.update();
+
+    // The network writes each epoch's metrics to this buffer (see
+    // TrainingMetrics): a header of 8 values, then records of 7 values
+    // (sequence number, epoch, training and testing MSE, training and
+    // testing accuracy, samples per second).
+    var view = new Float64Array(this.nn.metrics(epochs));
+    var next = 0;
+    var poll = () => {
+      var count = view[4];
+      // Records older than the ring are gone.
+      next = Math.max(next, count - view[0]);
+      for (; next < count; next++) {
+        var base = 8 + (next % view[0]) * view[1];
+        var sequence = view[base];
+        var epoch = view[base + 1];
+        var trainingAccuracy = view[base + 4];
+        var testingAccuracy = view[base + 5];
+        // Skip a record caught while it was being written.
+        if (sequence !== 2 * next + 2 || view[base] !== sequence) {
+          break;
+        }
+        trainingPoints.push({ x: epoch, y: trainingAccuracy });
+        testingPoints.push({ x: epoch, y: testingAccuracy });
+      }
+      this.chart.update();
+    };
+    var frame = () => {
+      if (training) {
+        poll();
+        requestAnimationFrame(frame);
+      }
+    };
+
+    this.nn.trainAsync(sets[0], sets[1], epochs, eta, logPath, TRAIN_OPTIONS, (error) => {
+      training = false;
+      poll();
+      if (error) {
+        this.log(error.message);
+        return;
+      }
+      done();
+    });
+    training = true;
+    requestAnimationFrame(frame);
+  };
   //
   this.appendAccuracyAndConfusion = function(sets) {
     this.log('');
@@ -181,6 +248,7 @@ var pages = {
       this.log(`Learning constant: ${eta}\n`);
 
       // Create new DataClass.
+      NeuralNetwork.seed(SEED);
       this.data = new DataClass('data/iris-original.dat');
       // Normalise data.
       this.data.normalise(0, 3);
@@ -195,26 +263,28 @@ var pages = {
         this.output.text.innerText += 'Training has begun.\n';
       }
       // Begin training.
-      this.nn.train(sets[0], sets[1], epochs, eta, 'logs/iris/neural-network.log');
-      // Let user know that training has ended.
-      if (this.output.text !== null) {
-        this.output.text.innerText += 'Training has ended after ' + epochs + ' epochs.\n\n';
-      }
+      this.train(sets, epochs, eta, 'logs/iris/neural-network.log', () => {
+        // Let user know that training has ended.
+        if (this.output.text !== null) {
+          this.output.text.innerText += 'Training has ended after ' + epochs + ' epochs.\n\n';
+        }
 
-      // Get accuracies of training, testing, and validation sets.
-      this.appendAccuracyAndConfusion(sets);
+        // Get accuracies of training, testing, and validation sets.
+        this.appendAccuracyAndConfusion(sets);
 
-      // Save weights for future use.
-      this.nn.save('logs/iris/weights.dat', false, 8);
-      this.output.text.innerText += 'Final weights saved.';
+        // Save weights for future use.
+        this.nn.save('logs/iris/weights.dat', false, 8);
+        this.output.text.innerText += 'Final weights saved.';
 
-      // Populate scatter plot.
-      this.populateChart();
+        // Populate scatter plot.
+        this.populateChart();
+      });
     }),
     new Page('Cancer', function() {
       // Empty output.
       this.output.text.innerText = '';
       // Create DataClass.
+      NeuralNetwork.seed(SEED);
       this.data = new DataClass('data/cancer.dat');
       // Normalise.
       this.data.normalise(0, 8);
@@ -231,21 +301,23 @@ var pages = {
       this.log('Training has begun.');
       var stopwatch = new Stopwatch();
       stopwatch.start();
-      this.nn.train(sets[0], sets[1], epochs, eta, 'logs/cancer/neural-network.log');
-      stopwatch.stop();
-      this.log(`Training has ended after ${stopwatch.elapsed()} milliseconds.\n`);
+      this.train(sets, epochs, eta, 'logs/cancer/neural-network.log', () => {
+        stopwatch.stop();
+        this.log(`Training has ended after ${stopwatch.elapsed()} milliseconds.\n`);
 
-      this.appendAccuracyAndConfusion(sets);
+        this.appendAccuracyAndConfusion(sets);
 
-      this.nn.save('logs/cancer/weights.dat', false, 8);
-      this.log('Final weights saved.');
+        this.nn.save('logs/cancer/weights.dat', false, 8);
+        this.log('Final weights saved.');
 
-      this.populateChart();
+        this.populateChart();
+      });
     }),
     new Page('Wine', function() {
       // Empty output.
       this.output.text.innerText = '';
       // Create data class.
+      NeuralNetwork.seed(SEED);
       this.data = new DataClass('data/wine.dat');
       // Normalise and make exemplar.
       this.data.normalise(0, 12);
@@ -261,16 +333,17 @@ var pages = {
       var stopwatch = new Stopwatch();
       stopwatch.start();
       this.log('Training has begun.');
-      this.nn.train(sets[0], sets[1], epochs, eta, 'logs/wine/neural-network.log');
-      stopwatch.stop();
-      this.log(`Training has ended after ${stopwatch.elapsed()} milliseconds.\n`);
+      this.train(sets, epochs, eta, 'logs/wine/neural-network.log', () => {
+        stopwatch.stop();
+        this.log(`Training has ended after ${stopwatch.elapsed()} milliseconds.\n`);
 
-      this.appendAccuracyAndConfusion(sets);
+        this.appendAccuracyAndConfusion(sets);
 
-      this.nn.save('logs/wine/weights.dat', false, 8);
-      this.log('Final weights saved.');
+        this.nn.save('logs/wine/weights.dat', false, 8);
+        this.log('Final weights saved.');
 
-      this.populateChart();
+        this.populateChart();
+      });
     })
   ],
   selected: 0,